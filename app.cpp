@@ -22,6 +22,7 @@
 
 #include "app.hpp"
 #include "style.hpp"
+#include "fft.hpp"
 
 
 App::App(SDL_Window *window, SDL_Renderer *renderer)
@@ -34,7 +35,9 @@ App::App(SDL_Window *window, SDL_Renderer *renderer)
 
 
 
-void App::config_fname(char *buf, size_t buflen)
+// Path of a file in the config directory, the session file by default
+
+void App::config_fname(char *buf, size_t buflen, const char *name)
 {
 	char dir[PATH_MAX];
 	const char *path = getenv("XDG_CONFIG_HOME");
@@ -47,7 +50,7 @@ void App::config_fname(char *buf, size_t buflen)
 		snprintf(dir, sizeof(dir), "./.fft");
 	}
 	mkdir(dir, 0755);
-	snprintf(buf, buflen, "%s/%s", dir, m_session_name);
+	snprintf(buf, buflen, "%s/%s", dir, name ? name : m_session_name);
 }
 
 
@@ -64,6 +67,11 @@ void App::load()
 		n->read("transport", m_transport);
 	}
 	if(auto n = cr.find("view")) m_view.load(n);
+
+	// before the panels, so the first plans of their widgets use it
+	config_fname(fname, sizeof(fname), "wisdom");
+	Fft::load_wisdom(fname);
+
 	if(auto n = cr.find("panel")) m_root_panel->load(n);
 	if(auto n = cr.find("stream")) m_stream.load(n);
 	if(auto n = cr.find("style")) Style::load(n);
@@ -101,6 +109,9 @@ void App::save()
 	cw.pop();
 
 	cw.close();
+
+	config_fname(fname, sizeof(fname), "wisdom");
+	Fft::save_wisdom(fname);
 }
 
 
@@ -132,14 +143,65 @@ int App::draw_topbar()
 	ImGui::SameLine();
 	ImGui::Text("srate: %.0fHz", m_srate);
 
-	size_t frames_avail{};
-	m_stream.peek(nullptr, &frames_avail);
 	ImGui::SameLine();
 	char buf[32];
-	duration_to_str(frames_avail / m_srate, buf, sizeof(buf));
-	float bytes = m_stream.channel_count() * sizeof(Sample) * frames_avail;
+	duration_to_str(m_stream.duration(), buf, sizeof(buf));
+	float bytes = m_stream.bytes_used();
 	ImGui::Text("| capture: %s, %.1fMb", buf, bytes / (1024.0 * 1024.0));
 
+	// discontinuities summed over all groups
+	size_t gap_count[(int)Discontinuities::Cause::COUNT]{};
+	Time gap_time[(int)Discontinuities::Cause::COUNT]{};
+	size_t gaps = 0;
+	for(size_t g=0; g<m_stream.group_count(); g++) {
+		auto &group = m_stream.group(g);
+		for(int i=0; i<(int)Discontinuities::Cause::COUNT; i++) {
+			auto cause = (Discontinuities::Cause)i;
+			gap_count[i] += group.discontinuities.count(cause);
+			gap_time[i] += group.discontinuities.frames(cause) / group.srate;
+			gaps += group.discontinuities.count(cause);
+		}
+	}
+	if(m_stream.recorder.is_open()) {
+		Recorder::Stats rs = m_stream.recorder.stats();
+		ImGui::SameLine();
+		ImGui::Text("| rec: %.1fMb", rs.bytes_written / (1024.0 * 1024.0));
+		if(ImGui::IsItemHovered()) {
+			ImGui::SetTooltip("frames lost: %zu\nwrite errors: %zu",
+					rs.frames_lost, rs.errors);
+		}
+	}
+
+	// pipeline stage lag, in time at the rate of the first group
+	if(!m_stream.mapped()) {
+		auto stats = m_stream.pipeline.stats();
+		Samplerate srate = m_stream.group(0).srate;
+		size_t lag = 0;
+		for(auto &st : stats) lag = std::max(lag, st.lag);
+		ImGui::SameLine();
+		ImGui::Text("| lag: %.0fms", lag / srate * 1000.0);
+		if(ImGui::IsItemHovered()) {
+			ImGui::BeginTooltip();
+			for(auto &st : stats) {
+				ImGui::Text("%-10s %6.0fms  max %6.0fms  skipped %zu", st.name,
+						st.lag / srate * 1000.0, st.lag_max / srate * 1000.0, st.frames_skipped);
+			}
+			ImGui::EndTooltip();
+		}
+	}
+
+	ImGui::SameLine();
+	ImGui::Text("| gaps: %zu", gaps);
+	if(ImGui::IsItemHovered()) {
+		ImGui::BeginTooltip();
+		for(int i=0; i<(int)Discontinuities::Cause::COUNT; i++) {
+			auto cause = (Discontinuities::Cause)i;
+			duration_to_str(gap_time[i], buf, sizeof(buf));
+			ImGui::Text("%-10s %8zu  %s", Discontinuities::cause_str(cause), gap_count[i], buf);
+		}
+		ImGui::EndTooltip();
+	}
+
 	auto io = ImGui::GetIO();
 	ImGui::SameLine();
 	ImGui::Text("| %.1f fps", io.Framerate);
@@ -224,12 +286,23 @@ void App::usage(void)
 		"  -c --capture         enable capture on start\n"
 		"  -d --buffer-depth N  set buffer depth to N bytes (default: 512MB)\n"
 		"  -h                   show help\n"
+		"  -H --huge-pages      back the buffers with huge pages, implies -P\n"
+		"  -l --latency MS      max capture wakeup latency (default: 10)\n"
+		"  -L --mlock           lock the buffers in memory\n"
+		"  -P --prefault        fault in the buffers at startup\n"
 		"  -r --sample-rate N   set sample rate to N (default: 48000)\n"
+		"  -t --sample-type T   buffer sample type s16|f16|f32 (default: s16)\n"
+		"  -w --record PATH     record all captured data to PATH.N.M.rec/PATH.N.idx\n"
 		"\n"
 		"sources:\n"
 		"  raw:FILENAME[:AUDIOSPEC]\n"
+		"  file:FILENAME[:AUDIOSPEC]   map wav/rf64/raw file without importing\n"
 		"  stdin[:AUDIOSPEC]\n"
 		"  audio[:CHANNELS]\n"
+		"  net:ADDR[:PORT][:CHANNELS][:l16|l24][:SRATE]   RTP multicast or unicast\n"
+		"\n"
+		"  sources ending in @SRATE are captured at that rate into their own\n"
+		"  channel group instead of being resampled to the stream rate\n"
 		"\n"
 		"audio spec:\n"
 		"  u8|s16|s32|f32|f64[:CHANNELS][:SRATE]\n"
@@ -267,16 +340,24 @@ void App::init(int argc, char **argv)
 		{"help",          no_argument,       0, 'h'},
 		{"capture",       no_argument,       0, 'c'},
 		{"sample-rate",   required_argument, 0, 'r'},
+		{"sample-type",   required_argument, 0, 't'},
+		{"record",        required_argument, 0, 'w'},
 		{"buffer-depth",  required_argument, 0, 'd'},
+		{"latency",       required_argument, 0, 'l'},
+		{"huge-pages",    no_argument,       0, 'H'},
+		{"mlock",         no_argument,       0, 'L'},
+		{"prefault",      no_argument,       0, 'P'},
 		{"session",       required_argument, 0, 's'},
 		{0, 0, 0, 0}
 	};
 
 	int opt_buffer_depth = 512 * 1024 * 1024;
 	bool opt_capture = false;
+	int opt_rb_flags = 0;
+	const char *opt_record = nullptr;
 
 	int opt;
-	while ((opt = getopt_long(argc, argv, "cd:hr:", long_options, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, "cd:hHl:LPr:t:w:", long_options, NULL)) != -1) {
 		switch (opt) {
 			case 'c':
 				opt_capture = true;
@@ -288,9 +369,32 @@ void App::init(int argc, char **argv)
 				usage();
 				::exit(0);
 				break;
+			case 'H':
+				opt_rb_flags |= Rb::HugePages | Rb::Prefault;
+				break;
+			case 'l':
+				m_stream.capture.set_latency(atof(optarg) / 1000.0);
+				break;
+			case 'L':
+				opt_rb_flags |= Rb::Lock;
+				break;
+			case 'P':
+				opt_rb_flags |= Rb::Prefault;
+				break;
 			case 'r':
 				m_srate = atof(optarg);
 				break;
+			case 't':
+				if(SampleType type; sample_type_from_str(optarg, &type)) {
+					m_stream.set_sample_type(type);
+				} else {
+					fprintf(stderr, "invalid sample type '%s'\n", optarg);
+					::exit(1);
+				}
+				break;
+			case 'w':
+				opt_record = optarg;
+				break;
 			case 's':
 				snprintf(m_session_name, sizeof(m_session_name), "%s", optarg);
 				break;
@@ -306,17 +410,37 @@ void App::init(int argc, char **argv)
 	m_stream.set_sample_rate(m_srate);
 	
 	for(int i=optind; i<argc; i++) {
-		m_stream.capture.add_source(argv[i]);
+		if(strncmp(argv[i], "file:", 5) == 0) {
+			char *path = strtok(argv[i] + 5, ":");
+			char *spec = strtok(nullptr, "");
+			if(!m_stream.open_file(path, spec)) {
+				::exit(1);
+			}
+		} else {
+			m_stream.capture.add_source(argv[i]);
+		}
 	}
 
-	if(m_stream.capture.channel_count() == 0) {
-		fprintf(stderr, "error: no input sources specified\n");
-		::exit(1);
+	if(m_stream.mapped()) {
+		if(m_stream.capture.channel_count() > 0) {
+			fprintf(stderr, "error: mapped files can not be combined with other sources\n");
+			::exit(1);
+		}
+		m_srate = m_stream.sample_rate();
+		m_view.time.from = 0.0;
+		m_view.time.to = m_stream.duration();
+	} else {
+		if(m_stream.capture.channel_count() == 0) {
+			fprintf(stderr, "error: no input sources specified\n");
+			::exit(1);
+		}
+		m_stream.allocate(opt_buffer_depth, opt_rb_flags);
+		if(opt_record && !m_stream.recorder.open(opt_record)) {
+			::exit(1);
+		}
+		m_stream.capture.start();
+		if(opt_capture) capture_toggle();
 	}
-	
-	m_stream.allocate(opt_buffer_depth);
-	m_stream.capture.start();
-	if(opt_capture) capture_toggle();
 	m_stream.player.seek(m_view.time.playpos);
 }
 
@@ -460,8 +584,6 @@ void App::run()
 						}
 						m_view.time.analysis = (frame_idx - m_view.window.size * 0.5) / m_srate;
 					}
-					size_t used = 0;
-					m_stream.peek(nullptr, &used);
 				}
 				if(event.user.code == k_user_event_audio_playback) {
 					ssize_t frame_idx = (size_t)(uintptr_t)event.user.data1;
@@ -480,6 +602,13 @@ void App::run()
 		}
 		while (SDL_PollEvent(&event));
 
+		// start reading recorded history that is about to be shown or played
+		m_stream.prefetch(m_view.time.from, m_view.time.to);
+		if(m_playback) {
+			m_stream.prefetch(m_view.time.playpos, m_view.time.playpos + 2.0);
+			player.stage_history();
+		}
+
 		if(m_redraw > 0) {
 			draw();
 			m_redraw --;
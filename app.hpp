@@ -14,7 +14,7 @@ class App {
 public:
 	App(SDL_Window *window, SDL_Renderer *renderer);
 
-	void config_fname(char *buf, size_t buflen);
+	void config_fname(char *buf, size_t buflen, const char *name = nullptr);
 	void load();
 	void save();
 
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "fft.hpp"
+
+// total number of samples transformed per measurement
+static const size_t k_samples = 1 << 24;
+
+
+static double now()
+{
+	using namespace std::chrono;
+	return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+// Time single and batched transforms of one configuration, including the
+// windowing of the input and the conversion to magnitudes
+
+template<typename T>
+static void bench(const char *type_name, size_t size, size_t stride, Fft::Mode mode)
+{
+	Fft fft;
+	fft.configure(size, Window::Type::Hanning, 5.0f, mode);
+
+	std::vector<T> input((size + Fft::k_batch) * stride);
+	for(size_t i=0; i<input.size(); i++) {
+		input[i] = (T)((i * 7919 % 2001) - 1000.0f);
+	}
+	std::vector<float> out(fft.out_size() * Fft::k_batch);
+	size_t runs = std::max(k_samples / size, (size_t)Fft::k_batch);
+
+	// single transforms
+	fft.run(input.data(), stride, out);
+	double t0 = now();
+	for(size_t i=0; i<runs; i++) {
+		fft.run(input.data() + i % Fft::k_batch * stride, stride, out);
+	}
+	double t_run = (now() - t0) / runs;
+
+	// batches of overlapping transforms
+	const T *inputs[Fft::k_batch];
+	for(size_t i=0; i<Fft::k_batch; i++) {
+		inputs[i] = input.data() + i * stride;
+	}
+	fft.run_batch(inputs, Fft::k_batch, stride, out);
+	t0 = now();
+	for(size_t i=0; i<runs; i+=Fft::k_batch) {
+		fft.run_batch(inputs, Fft::k_batch, stride, out);
+	}
+	double t_batch = (now() - t0) / runs;
+
+	printf("%-4s %6zu %3zu %-3s %10.0f %10.0f\n",
+			type_name, size, stride, mode == Fft::Mode::Log ? "log" : "lin",
+			t_run * 1e9, t_batch * 1e9);
+}
+
+
+// Benchmark of the FFT kernels for each sample type, channel stride and output
+// mode. Build with 'make bench-fft'.
+
+int main(int argc, char **argv)
+{
+	printf("type   size str mod  run ns/fft batch ns/fft\n");
+	for(size_t size : { 1024, 8192 }) {
+		for(size_t stride : { 1, 2, 8, 3 }) {
+			for(Fft::Mode mode : { Fft::Mode::Lin, Fft::Mode::Log }) {
+				bench<int16_t>("s16", size, stride, mode);
+				bench<_Float16>("f16", size, stride, mode);
+				bench<float>("f32", size, stride, mode);
+			}
+		}
+	}
+	return 0;
+}
@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <assert.h>
 #include <wordexp.h>
+#include <poll.h>
 
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_audio.h>
@@ -13,11 +14,16 @@
 #include "misc.hpp"
 #include "capture.hpp"
 #include "sourceregistry.hpp"
+#include "convert.hpp"
+
+
+// size of the blocks in which sources are merged into the ring buffer
+static const size_t k_merge_bytes = 16384;
 
 
 Capture::Capture(Stream &stream)
 	: m_stream(stream)
-	, m_spec{SDL_AUDIO_S16, 1, 8000}
+	, m_spec{k_sdl_sample_format, 1, 8000}
 {
 }
 
@@ -37,6 +43,15 @@ void Capture::set_sample_rate(Samplerate srate)
 }
 
 
+// Maximum time the capture thread sleeps when no source signals new data;
+// this bounds the latency for sources that can not signal themselves
+
+void Capture::set_latency(Time latency)
+{
+	m_latency = latency;
+}
+
+
 void Capture::start()
 {
 	size_t channel_count = 0;
@@ -46,7 +61,6 @@ void Capture::start()
 	}
 	
 	m_spec.channels = channel_count;
-	m_buf.resize(channel_count * 4096);
 }
 
 
@@ -54,7 +68,13 @@ void Capture::resume()
 {
 	if(!m_running) {
 
+		for(auto source : m_sources) {
+			source->ingest() = Source::Ingest{};
+			source->set_ratio(1.0);
+		}
+
 		m_running = true;
+		m_stream.pipeline.start();
 		m_thread = std::thread(&Capture::capture_thread, this);
 
 		for(auto source : m_sources) {
@@ -73,23 +93,46 @@ void Capture::pause()
 		}
 
 		m_running = false;
+		m_notifier.notify();
 		if(m_thread.joinable()) {
 			m_thread.join();
 		}
+		m_stream.pipeline.stop();
 	}
 }
 
 
+// A source description may end in @SRATE to capture the source at its own
+// sample rate instead of the stream rate; some sources pick their rate from
+// their own arguments. Sources are kept ordered by rate so that each rate
+// group occupies a contiguous range of stream channels.
+
 void Capture::add_source(const char *desc)
 {
 	char *desc_copy = strdup(desc);
+	SDL_AudioSpec dst_spec = m_spec;
+
+	char *at = strrchr(desc_copy, '@');
+	if(at) {
+		*at = '\0';
+		dst_spec.freq = atoi(at + 1);
+		if(dst_spec.freq <= 0) {
+			fprintf(stderr, "invalid sample rate in '%s'\n", desc);
+			free(desc_copy);
+			return;
+		}
+	}
 	
 	char *name = strtok(desc_copy, ":");
 	char *args = strtok(nullptr, "");
-	SDL_AudioSpec dst_spec = m_spec;
 	auto source = SourceRegistry::create(name, dst_spec, args);
 	if(source) {
-		m_sources.push_back(source);
+		source->set_notifier(&m_notifier);
+		auto pos = m_sources.end();
+		for(auto it=m_sources.begin(); it!=m_sources.end(); it++) {
+			if((*it)->src_spec().freq == source->src_spec().freq) pos = it + 1;
+		}
+		m_sources.insert(pos, source);
 	}
 	free(desc_copy);
 }
@@ -105,82 +148,278 @@ size_t Capture::channel_count()
 }
 
 
-void Capture::capture_thread()
+// Determine the number of frames to merge into a group. Normally this is the
+// lowest number of frames available from the group sources, but a realtime
+// source that has not delivered data for longer than the stall budget gets
+// padded with silence instead of holding up the whole group, at most for the
+// time it has been silent. Lag is judged by arrival time, not by queue depth,
+// so a bulk source with a deep queue never causes padding. Frames that arrive
+// late for a padded span are dropped to keep the sources aligned in time.
+// frame is the group frame number the next merge will write to.
+
+size_t Capture::collect(size_t group, size_t frame)
 {
-	uint64_t t_event = SDL_GetTicks() + 10;
+	size_t src_from = m_group_first[group];
+	size_t src_to = m_group_first[group + 1];
+	Stream::Group &g = m_stream.group(group);
+
+	Time t_now = hirestime();
+	Time t_stall = m_latency * 10;
+	size_t frame_count = SIZE_MAX;
+	size_t frame_count_stalled = SIZE_MAX;
+
+	for(size_t i=src_from; i<src_to; i++) {
+		Source *source = m_sources[i];
+		Source::Ingest &ingest = source->ingest();
+		size_t avail = source->frames_avail();
+
+		if(ingest.debt > 0 && avail > 0) {
+			size_t n = std::min(ingest.debt, avail);
+			m_discard.resize(n * source->channel_count());
+			n = source->read(m_discard.data(), source->channel_count(), n);
+			ingest.debt -= n;
+			ingest.frames_dropped += n;
+			g.discontinuities.add(frame, 0, Discontinuities::Cause::Drop, i);
+			avail -= n;
+		}
 
-	while(m_running) {
+		m_avail[i] = avail;
 
-		// poll all sources
-		for(auto source : m_sources) {
-			SDL_AudioStream *sas = source->sdl_audio_stream();
-			int bytes_queued = SDL_GetAudioStreamQueued(sas);
-			if(bytes_queued < 64000) {
-				source->poll();
-			}
+		// frames of silence owed to a realtime source whose data stopped
+		// arriving, beyond the stall budget and what was padded already
+		Time t_silent = t_now - source->t_put();
+		if(source->realtime() && source->t_put() > 0.0 && t_silent > t_stall) {
+			size_t owed = (t_silent - t_stall) * g.srate;
+			size_t pad = owed > ingest.debt ? owed - ingest.debt : 0;
+			frame_count_stalled = std::min(frame_count_stalled, avail + pad);
+		} else {
+			frame_count = std::min(frame_count, avail);
 		}
+	}
 
-		// calculate common lowest number of available frames
-		size_t frame_count = m_buf.size() / m_stream.channel_count();
-		for(auto source : m_sources) {
-			SDL_AudioStream *sas = source->sdl_audio_stream();
-			int bytes_avail = SDL_GetAudioStreamAvailable(sas);
-			if(bytes_avail < 0) {
-				printf("SDL_GetAudioStreamAvailable(): %s\n", SDL_GetError());
-				exit(1);
-			}
-			frame_count = std::min(frame_count, (size_t)bytes_avail / source->frame_size());
+	// stalled sources never hold up the others, but are not padded further
+	// than the time they have been silent
+	if(frame_count == SIZE_MAX) {
+		frame_count = 0;
+	}
+	if(frame_count_stalled != SIZE_MAX) {
+		frame_count = std::min(frame_count, frame_count_stalled);
+	}
+	frame_count = std::min(frame_count, m_frames_max);
+
+	for(size_t i=src_from; i<src_to; i++) {
+		if(m_avail[i] < frame_count) {
+			m_sources[i]->ingest().underruns ++;
 		}
+	}
 
-		// collect available frames from all sources into stream buffer
+	return frame_count;
+}
+
+
+// Let all sources of a group write their frames into their channel slots of
+// the group ring buffer. This is done in blocks small enough to keep the destination frames
+// in cache while all sources are merged in. Unless the stream stores f32,
+// sources write into a block buffer which is then stored in the stream sample
+// type.
+
+void Capture::merge(size_t group, uint8_t *buf, size_t frame, size_t frame_count)
+{
+	Stream::Group &g = m_stream.group(group);
+	size_t stride = g.channel_count;
+	size_t block_frames = std::max(k_merge_bytes / (stride * sizeof(Sample)), (size_t)16);
+	SampleType type = m_stream.sample_type();
+	bool direct = type == SampleTraits<Sample>::type;
+	m_block.resize(block_frames * stride);
+
+	for(size_t i=0; i<frame_count; i+=block_frames) {
+		size_t n = std::min(block_frames, frame_count - i);
+		uint8_t *out = buf + i * g.frame_size;
+		Sample *block = direct ? (Sample *)out : m_block.data();
 		size_t channel = 0;
-		if(frame_count > 0) {
-
-			size_t bytes_max = 0;
-			Sample *buf = (Sample *)m_stream.rb().write_ptr(&bytes_max);
-
-			for(auto &source : m_sources) {
-				// read data from source SDL audio stream
-				size_t source_channel_count = source->channel_count();
-				SDL_AudioStream *sas = source->sdl_audio_stream();
-				int bytes_want = frame_count * source_channel_count * sizeof(Sample);
-				int bytes_read = SDL_GetAudioStreamData(sas, m_buf.data(), bytes_want);
-				//assert(bytes_read >= 0);
-
-				// deinterleave into ring buffer
-				Sample *p_src = m_buf.data();
-				Sample *p_dst = buf + channel;
-				size_t src_stride = source_channel_count;
-				size_t dst_stride = m_stream.channel_count();
-				for(size_t i=0; i<frame_count; i++) {
-					memcpy(p_dst, p_src, source_channel_count * sizeof(Sample));
-					p_src += src_stride;
-					p_dst += dst_stride;
+		for(size_t j=m_group_first[group]; j<m_group_first[group + 1]; j++) {
+			Source *source = m_sources[j];
+			Sample *dst = block + channel;
+			size_t n_read = std::min(n, m_avail[j]);
+			if(n_read > 0) {
+				n_read = source->read(dst, stride, n_read);
+				m_avail[j] -= n_read;
+			}
+			if(n_read < n) {
+				Source::Ingest &ingest = source->ingest();
+				ingest.debt += n - n_read;
+				ingest.frames_padded += n - n_read;
+				g.discontinuities.add(frame + i + n_read, n - n_read, 
+						Discontinuities::Cause::Underrun, j);
+				for(size_t f=n_read; f<n; f++) {
+					memset(dst + f * stride, 0, source->channel_count() * sizeof(Sample));
 				}
+			}
+			channel += source->channel_count();
+		}
+		if(!direct) {
+			store_samples(type, out, block, n * stride);
+		}
+	}
+}
 
-				channel += source_channel_count;
+
+// Record the losses reported by the sources of a group for the frame_count
+// frames about to be written at group frame frame. Frames evicted from the
+// ring buffer are not a discontinuity, the stream range tells they are gone.
+
+void Capture::account(size_t group, size_t frame, size_t frame_count)
+{
+	Stream::Group &g = m_stream.group(group);
+	Discontinuities &d = g.discontinuities;
+
+	for(size_t i=m_group_first[group]; i<m_group_first[group + 1]; i++) {
+		Source *source = m_sources[i];
+		size_t lost = source->take_lost();
+		if(lost > 0) {
+			d.add(frame, lost, Discontinuities::Cause::Lost, i);
+		}
+		size_t errors = source->take_errors();
+		for(size_t j=0; j<errors; j++) {
+			d.add(frame, 0, Discontinuities::Cause::Error, i);
+		}
+	}
+}
+
+
+// Estimate for each source how much older its queued data is than the data
+// of the first realtime source, which acts as the clock reference; files and
+// generators have no clock of their own. The age is derived from the data
+// arrival timestamp and the queue level. Realtime sources on a different
+// hardware clock get their resample ratio adjusted by a slow PI controller
+// to keep this offset at zero.
+
+void Capture::update_drift(Time dt)
+{
+	static const double k_kp = 0.01;
+	static const double k_ki = 0.001;
+	static const double k_ratio_max = 0.005;
+
+	Time t_now = hirestime();
+	double alpha = std::min(dt / 1.0, 1.0);
+
+	auto head_time = [&](size_t i) {
+		Source *source = m_sources[i];
+		Time t_put = source->t_put();
+		if(t_put == 0.0) t_put = t_now;
+		return t_put - m_avail[i] / (double)source->src_spec().freq;
+	};
+
+	size_t ref = 0;
+	while(ref < m_sources.size() && !m_sources[ref]->realtime()) ref++;
+	if(ref == m_sources.size()) return;
+	Time t_head_ref = head_time(ref);
+
+	for(size_t i=0; i<m_sources.size(); i++) {
+		if(i == ref) continue;
+		Source *source = m_sources[i];
+		Source::Ingest &ingest = source->ingest();
+		Time t_head = head_time(i);
+
+		ingest.offset += (t_head_ref - t_head - ingest.offset) * alpha;
+
+		if(source->realtime()) {
+			ingest.integ += ingest.offset * k_ki * dt;
+			ingest.integ = std::clamp(ingest.integ, -k_ratio_max, k_ratio_max);
+			double ratio = 1.0 + std::clamp(ingest.offset * k_kp + ingest.integ, -k_ratio_max, k_ratio_max);
+			if(source->set_ratio(ratio)) {
+				ingest.ratio = ratio;
 			}
+		}
+	}
+}
+
+
+void Capture::capture_thread()
+{
+	Time t_drift = hirestime();
+
+	// first source of each group, the stream groups follow the source order
+	m_group_first.clear();
+	size_t src = 0;
+	for(size_t group=0; group<m_stream.group_count(); group++) {
+		m_group_first.push_back(src);
+		Samplerate srate = m_stream.group(group).srate;
+		while(src < m_sources.size() && m_sources[src]->src_spec().freq == srate) src++;
+	}
+	m_group_first.push_back(src);
+	m_avail.resize(m_sources.size());
+
+	while(m_running) {
 
-			// update ring buffer write pointer and wavecache
-			m_stream.rb().write_done(frame_count * m_stream.channel_count() * sizeof(Sample));
-			m_stream.wavecache().feed_frames(buf, frame_count, m_stream.channel_count());
-			m_frames_event += frame_count;
-
-			// signal main thread new audio is available
-			uint64_t t_now = SDL_GetTicks();
-			if(t_now > t_event) {
-				t_event += 10;
-				SDL_Event event;
-				SDL_zero(event);
-				event.type = SDL_EVENT_USER;
-				event.user.code = k_user_event_audio_capture;
-				event.user.data1 = (void *)(m_stream.rb().bytes_used() / (m_stream.channel_count() * sizeof(Sample)));
-				event.user.data2 = (void *)m_frames_event;
-				SDL_PushEvent(&event);
-				m_frames_event = 0;
+		m_notifier.clear();
+
+		// poll all sources
+		for(auto source : m_sources) {
+			source->poll();
+		}
+
+		bool written = false;
+
+		for(size_t group=0; group<m_stream.group_count(); group++) {
+
+			Stream::Group &g = m_stream.group(group);
+			size_t frame = g.rb.head() / g.frame_size;
+			size_t frame_count = collect(group, frame);
+			if(frame_count == 0) continue;
+
+			size_t bytes_write = frame_count * g.frame_size;
+			account(group, frame, frame_count);
+			uint8_t *buf = (uint8_t *)g.rb.write_ptr(bytes_write);
+			merge(group, buf, frame, frame_count);
+
+			// update ring buffer write pointer
+			g.rb.write_done(bytes_write);
+			written = true;
+		}
+
+		if(written) {
+
+			// let the pipeline stages pick up the new frames
+			m_stream.pipeline.notify();
+
+			// clock drift correction
+			Time t = hirestime();
+			if(t - t_drift > 0.1) {
+				update_drift(t - t_drift);
+				t_drift = t;
+				// spans older than the ring buffer are kept while
+				// recording since the frames are still available
+				for(size_t group=0; group<m_stream.group_count(); group++) {
+					Stream::Group &g = m_stream.group(group);
+					size_t frame = g.rb.head() / g.frame_size;
+					size_t frames_used = g.rb.bytes_used() / g.frame_size;
+					if(!m_stream.recorder.is_open()) {
+						g.discontinuities.prune(frame - frames_used);
+					}
+				}
 			}
 		} else {
-			usleep(1000);
+			wait();
+		}
+	}
+}
+
+
+// Block until a source signals new data, one of the source file descriptors
+// becomes readable or the latency target expires
+
+void Capture::wait()
+{
+	std::vector<struct pollfd> fds;
+	fds.push_back({ m_notifier.fd(), POLLIN, 0 });
+	for(auto source : m_sources) {
+		int fd = source->poll_fd();
+		if(fd != -1) {
+			fds.push_back({ fd, POLLIN, 0 });
 		}
 	}
+
+	int timeout = std::max((int)ceil(m_latency * 1000.0), 1);
+	poll(fds.data(), fds.size(), timeout);
 }
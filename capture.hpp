@@ -11,6 +11,7 @@
 
 #include "types.hpp"
 #include "source.hpp"
+#include "notifier.hpp"
 
 class Source;
 
@@ -20,6 +21,7 @@ public:
 	~Capture();
 
 	void set_sample_rate(Samplerate srate);
+	void set_latency(Time latency);
 	void start();
 	void resume();
 	void pause();
@@ -29,13 +31,23 @@ public:
 
 private:
 	std::vector<Source *> m_sources{};
-	std::vector<Sample> m_buf{};
+	size_t m_frames_max{4096};
+	std::vector<size_t> m_avail{};
+	std::vector<size_t> m_group_first{};
+	std::vector<Sample> m_discard{};
+	std::vector<Sample> m_block{};
 	std::thread m_thread;
 	std::atomic<bool> m_running{false};
 	void capture_thread();
+	size_t collect(size_t group, size_t frame);
+	void merge(size_t group, uint8_t *buf, size_t frame, size_t frame_count);
+	void account(size_t group, size_t frame, size_t frame_count);
+	void update_drift(Time dt);
+	void wait();
 	Stream &m_stream;
+	Notifier m_notifier;
+	Time m_latency{0.010};
 	SDL_AudioSpec m_spec{};
-	size_t m_frames_event{};
 };
 
 
@@ -0,0 +1,196 @@
+
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include <type_traits>
+#include <experimental/simd>
+
+#include <SDL3/SDL.h>
+
+#include "convert.hpp"
+#include "misc.hpp"
+
+namespace stdx = std::experimental;
+
+template<typename T, size_t W>
+using V = stdx::fixed_size_simd<T, W>;
+
+// number of samples converted per vector iteration
+static const size_t k_width = 16;
+
+
+template<typename T> struct Raw { typedef std::make_unsigned_t<T> type; };
+template<> struct Raw<float> { typedef uint32_t type; };
+
+
+template<typename U, size_t W>
+static V<U, W> bswap(V<U, W> v)
+{
+	if constexpr (sizeof(U) == 2) {
+		return (v << 8) | (v >> 8);
+	} else {
+		return (v << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) | (v >> 24);
+	}
+}
+
+
+// map a vector of integer source samples to the normalized Sample range.
+// They come widened to int32, converting narrower vectors to float directly
+// trips -Wmaybe-uninitialized in the AVX-512 headers of gcc 12.
+
+template<typename T, size_t W>
+static V<Sample, W> to_sample(V<int32_t, W> v)
+{
+	using Vf = V<float, W>;
+	if constexpr (std::is_same_v<T, uint8_t>) {
+		return (stdx::static_simd_cast<Vf>(v) - 128.0f) * (1.0f / 128.0f);
+	} else {
+		float scale = 1.0f / ((uint64_t)1 << (sizeof(T) * 8 - 1));
+		return stdx::static_simd_cast<Vf>(v) * scale;
+	}
+}
+
+
+template<typename T, bool Swap, size_t W>
+static void convert_block(Sample *dst, const uint8_t *src)
+{
+	using U = typename Raw<T>::type;
+	V<U, W> u([&](auto i) {
+		U r;
+		memcpy(&r, src + i * sizeof(U), sizeof(U));
+		return r;
+	});
+	if constexpr (Swap) {
+		u = bswap<U, W>(u);
+	}
+	T tmp[W];
+	for(size_t i=0; i<W; i++) {
+		U r = u[i];
+		memcpy(&tmp[i], &r, sizeof(T));
+	}
+	if constexpr (std::is_same_v<T, float>) {
+		V<float, W>(tmp, stdx::element_aligned).copy_to(dst, stdx::element_aligned);
+	} else {
+		V<int32_t, W> v([&](auto i) { return (int32_t)tmp[i]; });
+		to_sample<T, W>(v).copy_to(dst, stdx::element_aligned);
+	}
+}
+
+
+template<typename T, bool Swap>
+static void convert(Sample *dst, const void *src, size_t sample_count)
+{
+	const uint8_t *p = (const uint8_t *)src;
+	size_t i = 0;
+	for(; i+k_width<=sample_count; i+=k_width) {
+		convert_block<T, Swap, k_width>(dst + i, p + i * sizeof(T));
+	}
+	for(; i<sample_count; i++) {
+		convert_block<T, Swap, 1>(dst + i, p + i * sizeof(T));
+	}
+}
+
+
+// Packed 24 bit samples are loaded into the top of an int32 and converted
+// as such
+
+template<bool BigEndian, size_t W>
+static void convert_block_s24(Sample *dst, const uint8_t *src)
+{
+	V<int32_t, W> v([&](auto i) {
+		const uint8_t *p = src + i * 3;
+		uint32_t r = BigEndian ? 
+			((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) :
+			((uint32_t)p[2] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[0] << 8);
+		return (int32_t)r;
+	});
+	to_sample<int32_t, W>(v).copy_to(dst, stdx::element_aligned);
+}
+
+
+template<bool BigEndian>
+static void convert_s24(Sample *dst, const void *src, size_t sample_count)
+{
+	const uint8_t *p = (const uint8_t *)src;
+	size_t i = 0;
+	for(; i+k_width<=sample_count; i+=k_width) {
+		convert_block_s24<BigEndian, k_width>(dst + i, p + i * 3);
+	}
+	for(; i<sample_count; i++) {
+		convert_block_s24<BigEndian, 1>(dst + i, p + i * 3);
+	}
+}
+
+
+// Return the converter for the given format, or nullptr if not supported
+
+ConvertFn convert_fn(SDL_AudioFormat format)
+{
+	static constexpr bool le = __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+	// not in the SDL enum
+	if(format == k_sdl_audio_s24le) return convert_s24<false>;
+	if(format == k_sdl_audio_s24be) return convert_s24<true>;
+
+	switch(format) {
+		case SDL_AUDIO_U8: return convert<uint8_t, false>;
+		case SDL_AUDIO_S8: return convert<int8_t, false>;
+		case SDL_AUDIO_S16LE: return convert<int16_t, !le>;
+		case SDL_AUDIO_S16BE: return convert<int16_t, le>;
+		case SDL_AUDIO_S32LE: return convert<int32_t, !le>;
+		case SDL_AUDIO_S32BE: return convert<int32_t, le>;
+		case SDL_AUDIO_F32LE: return convert<float, !le>;
+		case SDL_AUDIO_F32BE: return convert<float, le>;
+		default: return nullptr;
+	}
+}
+
+
+// Store samples in the stream sample type, saturating integer types. Those
+// use a plain loop, which vectorizes as well, since the simd rounding and
+// narrowing conversions trip -Wmaybe-uninitialized in the AVX-512 headers
+// of gcc 12. _Float16 converts best from a simd vector.
+
+template<typename T, size_t W>
+static void store_block(T *dst, const Sample *src)
+{
+	V<float, W> v(src, stdx::element_aligned);
+	for(size_t i=0; i<W; i++) dst[i] = v[i];
+}
+
+
+template<typename T>
+static void store(T *dst, const Sample *src, size_t sample_count)
+{
+	size_t i = 0;
+	if constexpr (std::is_integral_v<T>) {
+		constexpr float max = SampleTraits<T>::max;
+		for(; i<sample_count; i++) {
+			dst[i] = std::round(std::clamp(src[i] * max, -max - 1.0f, max));
+		}
+	} else {
+		for(; i+k_width<=sample_count; i+=k_width) {
+			store_block<T, k_width>(dst + i, src + i);
+		}
+		for(; i<sample_count; i++) {
+			store_block<T, 1>(dst + i, src + i);
+		}
+	}
+}
+
+
+void store_samples(SampleType type, void *dst, const Sample *src, size_t sample_count)
+{
+	switch(type) {
+		case SampleType::S16: 
+			store((int16_t *)dst, src, sample_count); 
+			break;
+		case SampleType::F16: 
+			store((_Float16 *)dst, src, sample_count); 
+			break;
+		case SampleType::F32: 
+			memcpy(dst, src, sample_count * sizeof(float)); 
+			break;
+	}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <SDL3/SDL_audio.h>
+
+#include "types.hpp"
+
+// Vectorized converters from the SDL sample formats to Sample, including
+// byte swapping of non-native endian data, and from Sample to the stream
+// sample types with saturation.
+
+typedef void (*ConvertFn)(Sample *dst, const void *src, size_t sample_count);
+
+ConvertFn convert_fn(SDL_AudioFormat format);
+void store_samples(SampleType type, void *dst, const Sample *src, size_t sample_count);
@@ -0,0 +1,107 @@
+
+#include <algorithm>
+
+#include "discontinuity.hpp"
+
+// recent entries checked for coalescing a new span
+static const size_t k_coalesce_depth = 16;
+// bound on the number of entries kept
+static const size_t k_entries_max = 65536;
+
+
+void Discontinuities::add(size_t frame, size_t frame_count, Cause cause, int source)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_count[(int)cause] ++;
+	m_frames[(int)cause] += frame_count;
+
+	// extend a recent span of the same cause and source if contiguous
+	size_t n = std::min(m_entries.size(), k_coalesce_depth);
+	for(size_t i=0; i<n; i++) {
+		Entry &e = m_entries[m_entries.size() - 1 - i];
+		if(e.cause == cause && e.source == source && e.frame + e.frame_count == frame) {
+			e.frame_count += frame_count;
+			m_span_max = std::max(m_span_max, e.frame_count);
+			return;
+		}
+	}
+
+	if(m_entries.size() == k_entries_max) {
+		m_entries.pop_front();
+	}
+
+	// the recorder reports its losses late, so not all spans go at the end
+	auto it = std::upper_bound(m_entries.begin(), m_entries.end(), frame,
+			[](size_t f, const Entry &e) { return f < e.frame; });
+	m_entries.insert(it, { frame, frame_count, cause, source });
+	m_span_max = std::max(m_span_max, frame_count);
+}
+
+
+// Forget the oldest spans that ended before the given frame
+
+void Discontinuities::prune(size_t frame)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	while(!m_entries.empty() && m_entries.front().frame + m_entries.front().frame_count < frame) {
+		m_entries.pop_front();
+	}
+}
+
+
+// Return all spans overlapping frames frame_from .. frame_to. Zero length
+// spans, like dropped frames, are returned if they fall in the range. The
+// search starts at the longest span length before frame_from, since no span
+// starting earlier can reach into the range.
+
+void Discontinuities::query(size_t frame_from, size_t frame_to, std::vector<Entry> &entries)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	entries.clear();
+	size_t from = frame_from > m_span_max ? frame_from - m_span_max : 0;
+	auto it = std::lower_bound(m_entries.begin(), m_entries.end(), from,
+			[](const Entry &e, size_t f) { return e.frame < f; });
+	for(; it != m_entries.end() && it->frame < frame_to; it++) {
+		if(it->frame + it->frame_count >= frame_from) {
+			entries.push_back(*it);
+		}
+	}
+}
+
+
+size_t Discontinuities::count(Cause cause)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_count[(int)cause];
+}
+
+
+size_t Discontinuities::frames(Cause cause)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_frames[(int)cause];
+}
+
+
+void Discontinuities::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.clear();
+	m_span_max = 0;
+	std::fill(std::begin(m_count), std::end(m_count), 0);
+	std::fill(std::begin(m_frames), std::end(m_frames), 0);
+}
+
+
+const char *Discontinuities::cause_str(Cause cause)
+{
+	switch(cause) {
+		case Cause::Overwrite: return "overwrite";
+		case Cause::Underrun: return "underrun";
+		case Cause::Drop: return "drop";
+		case Cause::Lost: return "lost";
+		case Cause::Error: return "error";
+		default: return "unknown";
+	}
+}
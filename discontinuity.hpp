@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+// Index of all spans of the stream that do not hold a faithful copy of the
+// captured signal, in absolute stream frame numbers. Written by the capture
+// thread and the recorder, queried by the widgets. Spans are kept ordered by
+// their first frame, so queries only visit the spans they return.
+
+class Discontinuities {
+public:
+	enum class Cause {
+		Overwrite,      // frames retired from the ring buffer before being recorded
+		Underrun,       // source did not deliver in time, padded with silence
+		Drop,           // late source frames discarded to realign the sources, zero length
+		Lost,           // source reported data lost before it reached us
+		Error,          // source reported a read error
+		COUNT,
+	};
+
+	struct Entry {
+		size_t frame;
+		size_t frame_count;
+		Cause cause;
+		int source;
+	};
+
+	void add(size_t frame, size_t frame_count, Cause cause, int source = -1);
+	void prune(size_t frame);
+	void query(size_t frame_from, size_t frame_to, std::vector<Entry> &entries);
+	size_t count(Cause cause);
+	size_t frames(Cause cause);
+	void clear();
+
+	static const char *cause_str(Cause cause);
+
+private:
+	std::mutex m_mutex;
+	std::deque<Entry> m_entries;
+	size_t m_span_max{};
+	size_t m_count[(int)Cause::COUNT]{};
+	size_t m_frames[(int)Cause::COUNT]{};
+};
@@ -1,10 +1,480 @@
 #include <assert.h>
+#include <bit>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <set>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <atomic>
+#include <type_traits>
+#include <experimental/simd>
 
 #include "fft.hpp"
 
-Fft::Fft(bool approximate)
-	: m_approximate(approximate)
+// upper limit for a single background planning run. FFTW keeps the wisdom
+// of the last level it completed, so this is generous; it bounds how long
+// saving the wisdom and exiting wait for a running job.
+static const double k_plan_time_limit = 10.0;
+
+// transform sizes planned up front, the window sizes offered by the views
+static const size_t k_prewarm_size_min = 8;
+static const size_t k_prewarm_size_max = 32768;
+
+
+// The FFTW planner is not thread safe, all planning and wisdom calls go
+// through this lock
+static std::mutex s_planner_mutex;
+
+
+// Distance between the complex outputs of batched transforms, in bins. Rows
+// are padded to whole cache lines so every row starts aligned.
+
+static size_t bin_stride(size_t size)
+{
+	return (size / 2 + 1 + 15) & ~(size_t)15;
+}
+
+
+// Plan for howmany consecutive real to complex transforms of the given size,
+// with the real and imaginary parts of the output in separate arrays
+
+static fftwf_plan plan_r2c(size_t size, size_t howmany, float *in, float *re, float *im, unsigned flags)
+{
+	fftwf_iodim dim = { (int)size, 1, 1 };
+	fftwf_iodim howmany_dim = { (int)howmany, (int)size, (int)bin_stride(size) };
+	return fftwf_plan_guru_split_dft_r2c(1, &dim, 1, &howmany_dim, in, re, im, flags);
+}
+
+
+// fftwf_malloc'ed input and split output arrays for howmany transforms
+
+static void alloc_buffers(size_t size, size_t howmany, float **in, float **re, float **im)
+{
+	*in = (float *)fftwf_malloc(sizeof(float) * size * howmany);
+	*re = (float *)fftwf_malloc(sizeof(float) * bin_stride(size) * howmany);
+	*im = (float *)fftwf_malloc(sizeof(float) * bin_stride(size) * howmany);
+}
+
+
+static void free_buffers(float *in, float *re, float *im)
+{
+	fftwf_free(in);
+	fftwf_free(re);
+	fftwf_free(im);
+}
+
+
+// Background thread measuring plans for the sizes in use. The results end up
+// in the FFTW wisdom; each run that changed the wisdom bumps the generation
+// of its problem so that only its plans are replaced. The overall generation
+// changes with any of them and lets Fft instances check cheaply.
+
+class Planner {
+public:
+	~Planner();
+	void request(size_t size, size_t howmany);
+	void request_estimate(size_t size, size_t howmany);
+	size_t generation() { return m_generation.load(std::memory_order_acquire); }
+	size_t generation(size_t size, size_t howmany);
+	void bump();
+	void bump(size_t size, size_t howmany);
+
+private:
+	struct Job {
+		size_t size;
+		size_t howmany;
+		unsigned flags;
+	};
+
+	void planner_thread();
+
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<Job> m_queue{};
+	std::set<std::tuple<size_t, size_t>> m_requested{};
+	std::map<std::tuple<size_t, size_t>, size_t> m_generations{};
+	size_t m_epoch{};
+	std::thread m_thread;
+	bool m_stop{false};
+	std::atomic<size_t> m_generation{0};
+};
+
+// A cached plan, counting references from the cache and from Fft instances
+
+struct FftPlan {
+	fftwf_plan plan;
+	size_t generation;
+	size_t refs;
+};
+
+
+// Process wide cache of r2c plans keyed by size and batch count. Plans are
+// shared by all Fft instances, which run them on their own buffers with
+// fftwf_execute_split_dft_r2c(); these all come from fftwf_malloc() so the
+// alignment always matches the planning buffers. A cached plan is replaced
+// when the planner has improved the wisdom for its problem. Replaced plans
+// are destroyed once the last Fft using them let go, the next time the
+// planner lock is held.
+//
+// Lookups only take the cache lock, planning takes the planner lock as well.
+// Estimated plans for the window sizes the views offer are created on first
+// use, so switching between them never waits for a background run. Other
+// sizes are planned by the planner thread if it is busy.
+
+class PlanCache {
+public:
+	~PlanCache();
+	FftPlan *get(size_t size, size_t howmany, bool stale);
+	FftPlan *create(size_t size, size_t howmany);
+	void put(FftPlan *plan);
+	void reap();
+
+private:
+	struct Key {
+		size_t size;
+		size_t howmany;
+		auto operator<=>(const Key&) const = default;
+	};
+
+	void prewarm();
+	FftPlan *find(Key key, size_t generation, bool stale);
+	fftwf_plan plan(size_t size, size_t howmany, unsigned flags);
+	void insert(Key key, fftwf_plan plan, size_t generation);
+	void release(FftPlan *plan);
+
+	std::mutex m_mutex;
+	std::map<Key, FftPlan *> m_plans{};
+	std::vector<fftwf_plan> m_dead{};
+	bool m_prewarmed{false};
+};
+
+static PlanCache s_plans;
+
+// constructed after the cache so its thread is stopped before the cache goes
+static Planner s_planner;
+
+
+PlanCache::~PlanCache()
+{
+	std::lock_guard<std::mutex> lock(s_planner_mutex);
+	for(auto &[key, p] : m_plans) {
+		fftwf_destroy_plan(p->plan);
+		delete p;
+	}
+	for(auto plan : m_dead) fftwf_destroy_plan(plan);
+}
+
+
+// Drop a reference, the plan is destroyed later. Called with m_mutex held.
+
+void PlanCache::release(FftPlan *p)
+{
+	if(--p->refs == 0) {
+		m_dead.push_back(p->plan);
+		delete p;
+	}
+}
+
+
+void PlanCache::put(FftPlan *p)
+{
+	if(p) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		release(p);
+	}
+}
+
+
+// Destroy the plans no longer referenced. Called with the planner lock held.
+
+void PlanCache::reap()
+{
+	std::vector<fftwf_plan> dead;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		dead.swap(m_dead);
+	}
+	for(auto plan : dead) fftwf_destroy_plan(plan);
+}
+
+
+// Make plan the cached plan for key, replacing the previous one. Called with
+// m_mutex held.
+
+void PlanCache::insert(Key key, fftwf_plan plan, size_t generation)
+{
+	FftPlan *&p = m_plans[key];
+	if(p) release(p);
+	p = new FftPlan{ plan, generation, 1 };
+}
+
+
+// Plan from the wisdom, or estimated if there is none. Any wisdom from a
+// measured or more thorough run is accepted. Called with the planner lock
+// held.
+
+fftwf_plan PlanCache::plan(size_t size, size_t howmany, unsigned flags)
+{
+	float *in, *re, *im;
+	alloc_buffers(size, howmany, &in, &re, &im);
+	fftwf_plan plan = plan_r2c(size, howmany, in, re, im, FFTW_MEASURE | FFTW_WISDOM_ONLY);
+	if(plan == nullptr) {
+		plan = plan_r2c(size, howmany, in, re, im, flags);
+	}
+	free_buffers(in, re, im);
+	return plan;
+}
+
+
+// Create plans for all power of two window sizes, single and batched. Called
+// with the planner lock held.
+
+void PlanCache::prewarm()
+{
+	for(size_t size=k_prewarm_size_min; size<=k_prewarm_size_max; size*=2) {
+		for(size_t howmany : { (size_t)1, Fft::k_batch }) {
+			size_t generation = s_planner.generation(size, howmany);
+			fftwf_plan p = plan(size, howmany, FFTW_ESTIMATE);
+			std::lock_guard<std::mutex> lock(m_mutex);
+			insert({ size, howmany }, p, generation);
+		}
+	}
+	m_prewarmed = true;
+}
+
+
+// Cached plan for key with a reference for the caller, nullptr if there is
+// none or, unless stale is set, it is outdated
+
+FftPlan *PlanCache::find(Key key, size_t generation, bool stale)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_plans.find(key);
+	if(it == m_plans.end()) return nullptr;
+	FftPlan *p = it->second;
+	if(p->generation != generation && !stale) return nullptr;
+	p->refs ++;
+	return p;
+}
+
+
+// Current plan for the given problem, made from the best wisdom available if
+// there is none, with a reference for the caller. Called with the planner
+// lock held.
+
+FftPlan *PlanCache::create(size_t size, size_t howmany)
+{
+	reap();
+	if(!m_prewarmed) {
+		prewarm();
+	}
+
+	size_t generation = s_planner.generation(size, howmany);
+	Key key{ size, howmany };
+	FftPlan *p = find(key, generation, false);
+	if(p == nullptr) {
+		fftwf_plan plan = this->plan(size, howmany, FFTW_ESTIMATE);
+		std::lock_guard<std::mutex> lock(m_mutex);
+		insert(key, plan, generation);
+		p = m_plans[key];
+		p->refs ++;
+	}
+	return p;
+}
+
+
+// Plan for the given problem, from the best wisdom available, with a
+// reference for the caller to give back through put(). Sizes without wisdom
+// get an estimated plan right away and are measured in the background. Never
+// waits for the planner: if it is busy, the outdated plan is returned when
+// stale is set, otherwise nullptr. Without any plan for the problem the
+// planner thread makes the estimated one next.
+
+FftPlan *PlanCache::get(size_t size, size_t howmany, bool stale)
+{
+	Key key{ size, howmany };
+	FftPlan *p = find(key, s_planner.generation(size, howmany), false);
+
+	if(p == nullptr) {
+		std::unique_lock<std::mutex> planner_lock(s_planner_mutex, std::try_to_lock);
+		if(planner_lock.owns_lock()) {
+			p = create(size, howmany);
+		} else {
+			p = find(key, 0, true);
+			if(p == nullptr) {
+				s_planner.request_estimate(size, howmany);
+			} else if(!stale) {
+				put(p);
+				p = nullptr;
+			}
+		}
+	}
+
+	// the planner thread starts with the first request, after the first
+	// plans were made without waiting for it
+	s_planner.request(size, howmany);
+	return p;
+}
+
+
+Planner::~Planner()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cond.notify_one();
+	if(m_thread.joinable()) {
+		m_thread.join();
+	}
+}
+
+
+size_t Planner::generation(size_t size, size_t howmany)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_generations.find({ size, howmany });
+	return m_epoch + (it != m_generations.end() ? it->second : 0);
+}
+
+
+// New wisdom for all problems, as after loading it
+
+void Planner::bump()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_epoch ++;
+	m_generation.fetch_add(1, std::memory_order_release);
+}
+
+
+void Planner::bump(size_t size, size_t howmany)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_generations[{ size, howmany }] ++;
+	m_generation.fetch_add(1, std::memory_order_release);
+}
+
+
+// Queue a size for measuring, then for an exhaustive search
+
+void Planner::request(size_t size, size_t howmany)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_requested.insert({ size, howmany }).second) {
+		m_queue.push_back({ size, howmany, FFTW_MEASURE });
+		m_queue.push_back({ size, howmany, FFTW_PATIENT });
+		if(!m_thread.joinable()) {
+			m_thread = std::thread(&Planner::planner_thread, this);
+		}
+		m_cond.notify_one();
+	}
+}
+
+
+// Queue an estimated plan ahead of all measuring, for a size that was
+// needed while the planner was busy
+
+void Planner::request_estimate(size_t size, size_t howmany)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = std::find_if(m_queue.begin(), m_queue.end(), [&](Job &j) {
+		return j.size == size && j.howmany == howmany && j.flags == FFTW_ESTIMATE;
+	});
+	if(it == m_queue.end()) {
+		m_queue.push_front({ size, howmany, FFTW_ESTIMATE });
+		if(!m_thread.joinable()) {
+			m_thread = std::thread(&Planner::planner_thread, this);
+		}
+		m_cond.notify_one();
+	}
+}
+
+
+void Planner::planner_thread()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while(true) {
+		m_cond.wait(lock, [&] { return m_stop || !m_queue.empty(); });
+		if(m_stop) break;
+
+		// estimated plans go first, then measured plans for all sizes
+		// before the exhaustive ones
+		auto it = std::find_if(m_queue.begin(), m_queue.end(),
+				[](Job &j) { return j.flags == FFTW_ESTIMATE; });
+		if(it == m_queue.end()) {
+			it = std::find_if(m_queue.begin(), m_queue.end(),
+					[](Job &j) { return j.flags == FFTW_MEASURE; });
+		}
+		if(it == m_queue.end()) it = m_queue.begin();
+		Job job = *it;
+		m_queue.erase(it);
+		lock.unlock();
+
+		if(job.flags == FFTW_ESTIMATE) {
+			// the cache keeps the plan for update_plans() to pick up
+			{
+				std::lock_guard<std::mutex> planner_lock(s_planner_mutex);
+				s_plans.put(s_plans.create(job.size, job.howmany));
+			}
+			lock.lock();
+			continue;
+		}
+
+		bool changed;
+		{
+			std::lock_guard<std::mutex> planner_lock(s_planner_mutex);
+			char *before = fftwf_export_wisdom_to_string();
+			float *in, *re, *im;
+			alloc_buffers(job.size, job.howmany, &in, &re, &im);
+			fftwf_set_timelimit(k_plan_time_limit);
+			fftwf_plan plan = plan_r2c(job.size, job.howmany, in, re, im, job.flags);
+			fftwf_set_timelimit(FFTW_NO_TIMELIMIT);
+			if(plan) fftwf_destroy_plan(plan);
+			free_buffers(in, re, im);
+			s_plans.reap();
+			char *after = fftwf_export_wisdom_to_string();
+			changed = !before || !after || strcmp(before, after) != 0;
+			free(before);
+			free(after);
+		}
+		if(changed) {
+			bump(job.size, job.howmany);
+		}
+
+		lock.lock();
+	}
+}
+
+
+// Load wisdom, to be called before the first Fft is configured. Plans made
+// before are replaced on their next use.
+
+bool Fft::load_wisdom(const char *fname)
+{
+	std::lock_guard<std::mutex> lock(s_planner_mutex);
+	bool ok = fftwf_import_wisdom_from_filename(fname);
+	if(ok) s_planner.bump();
+	return ok;
+}
+
+
+bool Fft::save_wisdom(const char *fname)
+{
+	std::lock_guard<std::mutex> lock(s_planner_mutex);
+	return fftwf_export_wisdom_to_filename(fname);
+}
+
+
+Fft::Fft()
 {
 	configure(1024, Window::Type::Hanning, 0.0f);
 }
@@ -12,8 +482,10 @@ Fft::Fft(bool approximate)
 
 Fft::~Fft()
 {
-	if(m_plan) fftwf_destroy_plan(m_plan);
-	if(m_in) fftwf_free(m_in);
+	s_plans.put(m_plan);
+	s_plans.put(m_batch_plan);
+	free_buffers(m_in, m_re, m_im);
+	free_buffers(m_batch_in, m_batch_re, m_batch_im);
 }
 
 
@@ -21,16 +493,22 @@ void Fft::configure(size_t size, Window::Type window_type, float window_beta, Mo
 {
 	if(m_window.size() != size || m_window.type() != window_type || m_window.beta() != window_beta) {
 		m_window.configure(window_type, size, window_beta);
+		m_window_scale = 0.0f;
 	}
 
 	if(m_size != size) {
 		m_size = size;
-		if(m_in) free(m_in);
-		m_in = (float*)fftwf_malloc(sizeof(float) * size);
-		m_out.resize(size / 2 + 1);
-		m_out.resize(size / 2 + 1);
-		if(m_plan) fftwf_destroy_plan(m_plan);
-		m_plan = fftwf_plan_r2r_1d(size, m_in, m_in, FFTW_R2HC, FFTW_ESTIMATE);
+		free_buffers(m_in, m_re, m_im);
+		alloc_buffers(size, 1, &m_in, &m_re, &m_im);
+		// the plan may be outdated or missing if the planner is busy,
+		// look for a better one on the first run
+		m_plan_generation = SIZE_MAX;
+		s_plans.put(m_plan);
+		m_plan = s_plans.get(size, 1, true);
+		free_buffers(m_batch_in, m_batch_re, m_batch_im);
+		m_batch_in = m_batch_re = m_batch_im = nullptr;
+		s_plans.put(m_batch_plan);
+		m_batch_plan = nullptr;
 	}
 
 	m_mode = mode;
@@ -39,75 +517,262 @@ void Fft::configure(size_t size, Window::Type window_type, float window_beta, Mo
 
 int Fft::out_size()
 {
-	return m_out.size();
+	return m_size / 2 + 1;
 }
 
 
-static inline float real_20log10(float v)
+// 10 * log10(x) = k_db_per_log2 * log2(x)
+static const float k_db_per_log2 = 3.01029995664f;
+
+// power floor, -200 dB
+static const float k_power_min = 1e-20f;
+
+// bins converted per vector iteration
+static const size_t k_width = 16;
+
+namespace stdx = std::experimental;
+using Vf = stdx::fixed_size_simd<float, k_width>;
+using Vi = stdx::fixed_size_simd<int32_t, k_width>;
+
+
+// log2 of positive normal numbers: the exponent plus a polynomial of the
+// mantissa, taken in [sqrt(0.5), sqrt(2)). The error is below 2e-5, or
+// 5e-5 dB.
+
+static Vf log2_poly(Vf x)
 {
-	return 20.0f * log10f(v + 1e-10f);
+	Vi bits = stdx::__proposed::simd_bit_cast<Vi>(x);
+	Vi e = (bits - 0x3f3504f3) >> 23;
+	Vf t = stdx::__proposed::simd_bit_cast<Vf>(bits - (e << 23)) - 1.0f;
+	Vf p = 1.44252155f + t * (-0.720400704f + t * (0.488227277f + t * (-0.392469764f + t * 0.242395614f)));
+	return stdx::static_simd_cast<Vf>(e) + t * p;
 }
 
 
-static inline float fast_20log10(float v)
+static float log2_poly(float x)
 {
-	int32_t i_v = std::bit_cast<int32_t>(v + 1e-10f);
-	float vout = (float)i_v * 7.17897e-7f - 764.616f;
-	return vout;
+	int32_t bits = std::bit_cast<int32_t>(x);
+	int32_t e = (bits - 0x3f3504f3) >> 23;
+	float t = std::bit_cast<float>(bits - (e << 23)) - 1.0f;
+	float p = 1.44252155f + t * (-0.720400704f + t * (0.488227277f + t * (-0.392469764f + t * 0.242395614f)));
+	return e + t * p;
 }
 
 
-static inline float fast_hypot(float x, float y)
+// Magnitudes of count bins given as separate real and imaginary parts,
+// scaled, and in dB if log is set. Magnitude and level are computed in one
+// pass from the power.
+
+static void magnitude(const float *re, const float *im, float *out, size_t count, float scale, bool log)
 {
-	float vmax = std::max(fabs(x), fabs(y));
-	float vmin = std::min(fabs(x), fabs(y));
-	return vmax * 0.96 + vmin * 0.4f;
+	float scale2 = scale * scale;
+
+	// stdx::sqrt trips -Wmaybe-uninitialized in the AVX-512 headers of
+	// gcc 12, the plain loop vectorizes all the same
+	if(!log) {
+		for(size_t i=0; i<count; i++) {
+			out[i] = sqrtf((re[i] * re[i] + im[i] * im[i]) * scale2);
+		}
+		return;
+	}
+
+	size_t i = 0;
+	for(; i+k_width<=count; i+=k_width) {
+		Vf vre(re + i, stdx::element_aligned);
+		Vf vim(im + i, stdx::element_aligned);
+		Vf power = (vre * vre + vim * vim) * scale2;
+		(log2_poly(power + k_power_min) * k_db_per_log2).copy_to(out + i, stdx::element_aligned);
+	}
+	for(; i<count; i++) {
+		float power = (re[i] * re[i] + im[i] * im[i]) * scale2;
+		out[i] = log2_poly(power + k_power_min) * k_db_per_log2;
+	}
 }
 
 
-std::vector<float> Fft::run(Sample *input, size_t stride)
+// Pick up improved wisdom, unless the planner is busy. Missing plans are
+// replaced by outdated ones if that is all there is, and looked for again on
+// the next run.
+
+void Fft::update_plans()
 {
-	// window input data
-	auto window = m_window.data();
-	for(size_t i=0; i<m_size; i++) {
-		m_in[i] = input[i * stride] * window[i] / k_sample_max;
+	size_t generation = s_planner.generation();
+	if(m_plan_generation != generation) {
+		bool stale = m_plan == nullptr || (m_batch_in && m_batch_plan == nullptr);
+		FftPlan *plan = s_plans.get(m_size, 1, stale);
+		FftPlan *batch_plan = m_batch_in ? s_plans.get(m_size, k_batch, stale) : nullptr;
+		if(plan && (batch_plan || !m_batch_in)) {
+			s_plans.put(m_plan);
+			s_plans.put(m_batch_plan);
+			m_plan = plan;
+			m_batch_plan = batch_plan;
+			if(!stale) m_plan_generation = generation;
+		} else {
+			s_plans.put(plan);
+			s_plans.put(batch_plan);
+		}
 	}
+}
 
-	// run fft
-	fftwf_execute(m_plan);
 
-	// convert half complex to magnitude
-	float scale = m_window.gain() * 2.0f / m_size;
-	m_out[0] = fabs(m_in[0]) * scale * 0.5;
-	if(m_approximate) {
-		for(size_t i=1; i<m_size/2; i++) {
-			m_out[i] = fast_hypot(m_in[i], m_in[m_size - i]) * scale;
+// Gather count samples spaced stride apart, convert them to float and
+// multiply with the window. Returns the sum of the samples before windowing.
+// Stride is a compile time constant for the common channel counts; 0 takes
+// the stride argument instead. The plain loop vectorizes best for int16 and
+// float (see bench-fft), and keeps clear of the -Wmaybe-uninitialized the
+// AVX-512 headers of gcc 12 raise for converting simd loads. _Float16 is
+// not a simd element type, but converting it element by element into a
+// vector lets the compiler use the hardware conversion, which the plain loop
+// does not.
+
+template<typename T, size_t Stride>
+static float gather(float *dst, const T *src, size_t stride, const float *window, size_t count)
+{
+	if(Stride) stride = Stride;
+	size_t i = 0;
+	float total = 0.0f;
+	if constexpr (std::is_same_v<T, _Float16>) {
+		Vf sum = 0.0f;
+		for(; i+k_width<=count; i+=k_width) {
+			Vf v([&](auto j) { return (float)src[(i + j) * stride]; });
+			sum += v;
+			(v * Vf(window + i, stdx::element_aligned)).copy_to(dst + i, stdx::element_aligned);
 		}
-	} else {
-		for(size_t i=1; i<m_size/2; i++) {
-			m_out[i] = hypotf(m_in[i], m_in[m_size - i]) * scale;
+		total = stdx::reduce(sum);
+	}
+	for(; i<count; i++) {
+		float v = src[i * stride];
+		total += v;
+		dst[i] = v * window[i];
+	}
+	return total;
+}
+
+
+template<typename T>
+using GatherFn = float (*)(float *dst, const T *src, size_t stride, const float *window, size_t count);
+
+template<typename T>
+static GatherFn<T> gather_fn(size_t stride)
+{
+	switch(stride) {
+		case 1: return gather<T, 1>;
+		case 2: return gather<T, 2>;
+		case 4: return gather<T, 4>;
+		case 8: return gather<T, 8>;
+		case 16: return gather<T, 16>;
+		default: return gather<T, 0>;
+	}
+}
+
+
+// Window input data into the transform buffer. The window is kept prescaled
+// by 1/max of the input type, and with DC removal enabled the mean of the
+// input is subtracted, which amounts to subtracting the mean times the
+// window from the windowed samples.
+
+template<typename T>
+void Fft::load(float *dst, const T *input, size_t stride)
+{
+	constexpr float scale_in = 1.0f / SampleTraits<T>::max;
+	if(m_window_scale != scale_in) {
+		auto &window = m_window.data();
+		m_window_scaled.resize(m_size);
+		for(size_t i=0; i<m_size; i++) {
+			m_window_scaled[i] = window[i] * scale_in;
 		}
+		m_window_scale = scale_in;
 	}
-	m_out[m_size / 2] = fabs(m_in[m_size / 2]) * scale * 0.5;
 
-	// convert to desired mode
-	if(m_mode == Mode::Lin) {
-		for(size_t i=0; i<m_out.size(); i++) {
-			m_out[i] = m_out[i];
+	const float *window = m_window_scaled.data();
+	float sum = gather_fn<T>(stride)(dst, input, stride, window, m_size);
+
+	if(m_remove_dc) {
+		float mean = sum / m_size;
+		for(size_t i=0; i<m_size; i++) {
+			dst[i] -= mean * window[i];
 		}
+	}
+}
+
+
+// Convert a complex transform to magnitudes in the configured mode. DC and,
+// for even sizes, the Nyquist bin have no negative frequency counterpart and
+// get half the scale.
+
+void Fft::convert(const float *re, const float *im, float *out)
+{
+	size_t bins = out_size();
+	size_t last = (m_size % 2 == 0) ? bins - 1 : bins;
+	float scale = m_window.gain() * 2.0f / m_size;
+	bool log = m_mode == Mode::Log;
+
+	magnitude(re, im, out, 1, scale * 0.5f, log);
+	magnitude(re + 1, im + 1, out + 1, last - 1, scale, log);
+	if(last < bins) {
+		magnitude(re + last, im + last, out + last, 1, scale * 0.5f, log);
+	}
+}
+
+
+// Transform one input into out, which holds out_size() values. Until the
+// planner thread made a plan for a new size the output is silence.
+
+template<typename T>
+void Fft::run(const T *input, size_t stride, std::span<float> out)
+{
+	assert(out.size() >= (size_t)out_size());
+	update_plans();
+	if(m_plan) {
+		load(m_in, input, stride);
+		fftwf_execute_split_dft_r2c(m_plan->plan, m_in, m_re, m_im);
 	} else {
-		if(m_approximate) {
-			for(size_t i=0; i<m_out.size(); i++) {
-				m_out[i] = fast_20log10(m_out[i]);
-			}
-		} else {
-			for(size_t i=0; i<m_out.size(); i++) {
-				m_out[i] = real_20log10(m_out[i]);
-			}
+		memset(m_re, 0, sizeof(float) * out_size());
+		memset(m_im, 0, sizeof(float) * out_size());
+	}
+	convert(m_re, m_im, out.data());
+}
+
+
+// Transform up to k_batch inputs with one batched plan. out receives
+// out_size() values per input; rows without input are left untouched, rows
+// transformed before there is a plan are silence.
+
+template<typename T>
+void Fft::run_batch(const T *const input[], size_t count, size_t stride, std::span<float> out)
+{
+	assert(count <= k_batch);
+	assert(out.size() >= count * out_size());
+
+	if(m_batch_in == nullptr) {
+		alloc_buffers(m_size, k_batch, &m_batch_in, &m_batch_re, &m_batch_im);
+		memset(m_batch_in, 0, sizeof(float) * m_size * k_batch);
+		m_batch_plan = s_plans.get(m_size, k_batch, true);
+		m_plan_generation = SIZE_MAX;
+	}
+	update_plans();
+
+	size_t os = bin_stride(m_size);
+	if(m_batch_plan) {
+		for(size_t i=0; i<count; i++) {
+			if(input[i]) load(m_batch_in + i * m_size, input[i], stride);
 		}
+		fftwf_execute_split_dft_r2c(m_batch_plan->plan, m_batch_in, m_batch_re, m_batch_im);
+	} else {
+		memset(m_batch_re, 0, sizeof(float) * os * count);
+		memset(m_batch_im, 0, sizeof(float) * os * count);
 	}
 
-	return m_out;
+	for(size_t i=0; i<count; i++) {
+		if(input[i]) convert(m_batch_re + i * os, m_batch_im + i * os, out.data() + i * out_size());
+	}
 }
 
 
+template void Fft::run<int16_t >(const int16_t *input,  size_t stride, std::span<float> out);
+template void Fft::run<_Float16>(const _Float16 *input, size_t stride, std::span<float> out);
+template void Fft::run<float   >(const float *input,    size_t stride, std::span<float> out);
+
+template void Fft::run_batch<int16_t >(const int16_t *const input[],  size_t count, size_t stride, std::span<float> out);
+template void Fft::run_batch<_Float16>(const _Float16 *const input[], size_t count, size_t stride, std::span<float> out);
+template void Fft::run_batch<float   >(const float *const input[],    size_t count, size_t stride, std::span<float> out);
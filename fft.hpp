@@ -4,29 +4,55 @@
 #include <fftw3.h>
 #include <math.h>
 #include <map>
+#include <span>
+#include <vector>
 
 #include "window.hpp"
 
+struct FftPlan;
+
 class Fft {
 
 public:
 
 	enum Mode { Lin, Log };
 
-	Fft(bool approximate=false);
+	Fft();
 	~Fft();
 
 	void configure(size_t size, Window::Type type, float beta=5.0f, Mode mode=Mode::Log);
 	int out_size();
-	std::vector<float> run(Sample *input, size_t stride=1);
-	void set_approximate(bool v) { m_approximate = v; }
+	void set_remove_dc(bool v) { m_remove_dc = v; }
+	template<typename T>
+	void run(const T *input, size_t stride, std::span<float> out);
+	template<typename T>
+	void run_batch(const T *const input[], size_t count, size_t stride, std::span<float> out);
+
+	static bool load_wisdom(const char *fname);
+	static bool save_wisdom(const char *fname);
+
+	// number of transforms run at once by run_batch()
+	static const size_t k_batch = 16;
 
 private:
-	bool m_approximate{false};
-	fftwf_plan m_plan{nullptr};
+	void update_plans();
+	template<typename T>
+	void load(float *dst, const T *input, size_t stride);
+	void convert(const float *re, const float *im, float *out);
+
+	FftPlan *m_plan{};
+	size_t m_plan_generation{};
 	Window m_window{};
+	std::vector<float> m_window_scaled{};
+	float m_window_scale{};
+	bool m_remove_dc{false};
 	size_t m_size{};
 	float *m_in{};
-	std::vector<float> m_out{};
+	float *m_re{};
+	float *m_im{};
+	float *m_batch_in{};
+	float *m_batch_re{};
+	float *m_batch_im{};
+	FftPlan *m_batch_plan{};
 	Mode m_mode{Mode::Log};
 };
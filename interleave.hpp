@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string.h>
+#include <stddef.h>
+
+#include "types.hpp"
+
+// Kernels for copying interleaved source frames into a wider interleaved
+// destination, as used to merge all sources into the stream ring buffer.
+// Common channel counts get a compile time specialization, so copying a
+// frame is a fixed size move instead of a libc call; interleave_fn() picks
+// one once per block, and returns nullptr for other counts, which are
+// handled by interleave_n().
+
+typedef void (*InterleaveFn)(Sample *dst, size_t dst_stride, const Sample *src, size_t frame_count);
+
+
+template<size_t N>
+void interleave(Sample *dst, size_t dst_stride, const Sample *src, size_t frame_count)
+{
+	if(dst_stride == N) {
+		memcpy(dst, src, frame_count * N * sizeof(Sample));
+		return;
+	}
+
+	size_t i = 0;
+	for(; i+4<=frame_count; i+=4) {
+		memcpy(dst + 0 * dst_stride, src + 0 * N, N * sizeof(Sample));
+		memcpy(dst + 1 * dst_stride, src + 1 * N, N * sizeof(Sample));
+		memcpy(dst + 2 * dst_stride, src + 2 * N, N * sizeof(Sample));
+		memcpy(dst + 3 * dst_stride, src + 3 * N, N * sizeof(Sample));
+		src += 4 * N;
+		dst += 4 * dst_stride;
+	}
+	for(; i<frame_count; i++) {
+		memcpy(dst, src, N * sizeof(Sample));
+		src += N;
+		dst += dst_stride;
+	}
+}
+
+
+inline void interleave_n(Sample *dst, size_t dst_stride, const Sample *src, size_t src_stride, size_t frame_count)
+{
+	if(dst_stride == src_stride) {
+		memcpy(dst, src, frame_count * src_stride * sizeof(Sample));
+		return;
+	}
+	for(size_t i=0; i<frame_count; i++) {
+		memcpy(dst, src, src_stride * sizeof(Sample));
+		src += src_stride;
+		dst += dst_stride;
+	}
+}
+
+
+inline InterleaveFn interleave_fn(size_t channels)
+{
+	switch(channels) {
+		case 1: return interleave<1>;
+		case 2: return interleave<2>;
+		case 4: return interleave<4>;
+		case 8: return interleave<8>;
+		default: return nullptr;
+	}
+}
@@ -21,6 +21,9 @@ static struct {
 	{ "s16",    SDL_AUDIO_S16 },
 	{ "s16le",  SDL_AUDIO_S16LE },
 	{ "s16be",  SDL_AUDIO_S16BE },
+	{ "s24",    k_sdl_audio_s24le },
+	{ "s24le",  k_sdl_audio_s24le },
+	{ "s24be",  k_sdl_audio_s24be },
 	{ "s32",    SDL_AUDIO_S32 },
 	{ "s32le",  SDL_AUDIO_S32LE },
 	{ "s32be",  SDL_AUDIO_S32BE },
@@ -77,6 +80,29 @@ Db gain_to_db(Gain gain)
 }
 
 
+const char *sample_type_to_str(SampleType type)
+{
+	switch(type) {
+		case SampleType::S16: return "s16";
+		case SampleType::F16: return "f16";
+		case SampleType::F32: return "f32";
+	}
+	return "unknown";
+}
+
+
+bool sample_type_from_str(const char *s, SampleType *type)
+{
+	for(SampleType t : { SampleType::S16, SampleType::F16, SampleType::F32 }) {
+		if(strcmp(s, sample_type_to_str(t)) == 0) {
+			*type = t;
+			return true;
+		}
+	}
+	return false;
+}
+
+
 SDL_AudioSpec sdl_audiospec_from_str(char *args)
 {
 	SDL_AudioSpec fmt;
@@ -3,6 +3,7 @@
 #pragma once
 
 #include <vector>
+#include <span>
 #include <math.h>
 #include <algorithm>
 
@@ -12,6 +13,15 @@
 #include "types.hpp"
 
 
+static const SDL_AudioFormat k_sdl_sample_format = SDL_AUDIO_F32;
+
+// packed 24 bit PCM, which SDL has no format for, encoded the SDL way
+static const SDL_AudioFormat k_sdl_audio_s24le = (SDL_AudioFormat)SDL_DEFINE_AUDIO_FORMAT(1, 0, 0, 24);
+static const SDL_AudioFormat k_sdl_audio_s24be = (SDL_AudioFormat)SDL_DEFINE_AUDIO_FORMAT(1, 1, 0, 24);
+
+const char *sample_type_to_str(SampleType type);
+bool sample_type_from_str(const char *s, SampleType *type);
+
 #define CONCAT(lhs, rhs) lhs # rhs
 #define CONCAT_WRAPPER(lhs, rhs) CONCAT(lhs, rhs)
 #define UNIQUE_ID CONCAT_WRAPPER(__FILE__, __LINE__)
@@ -41,7 +51,7 @@ Gain db_to_gain(Db db);
 Db gain_to_db(Gain gain);
 
 template<typename T>
-T tabread2(const std::vector<T>& vs, double pos, T v_oob = T{})
+T tabread2(std::span<const T> vs, double pos, T v_oob = T{})
 {
     if (pos < 0.0 || pos > 1.0) {
         return v_oob;
@@ -64,3 +74,9 @@ T tabread2(const std::vector<T>& vs, double pos, T v_oob = T{})
     const T& v1 = vs[j];
     return (v0 * a1) + (v1 * a0);
 }
+
+template<typename T>
+T tabread2(const std::vector<T>& vs, double pos, T v_oob = T{})
+{
+    return tabread2(std::span<const T>(vs), pos, v_oob);
+}
@@ -0,0 +1,39 @@
+
+#include <assert.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "notifier.hpp"
+
+Notifier::Notifier()
+{
+	m_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	assert(m_fd != -1);
+}
+
+
+Notifier::~Notifier()
+{
+	if(m_fd != -1) {
+		close(m_fd);
+	}
+}
+
+
+// Wait-free, safe to call from realtime audio callbacks
+
+void Notifier::notify()
+{
+	uint64_t v = 1;
+	ssize_t r = write(m_fd, &v, sizeof(v));
+	(void)r;
+}
+
+
+void Notifier::clear()
+{
+	uint64_t v;
+	ssize_t r = read(m_fd, &v, sizeof(v));
+	(void)r;
+}
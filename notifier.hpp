@@ -0,0 +1,18 @@
+#pragma once
+
+// Wakeup primitive backed by an eventfd. Any thread can notify(), the
+// waiting thread polls on fd() and calls clear() before checking for work.
+
+class Notifier {
+
+public:
+	Notifier();
+	~Notifier();
+
+	int fd() { return m_fd; }
+	void notify();
+	void clear();
+
+private:
+	int m_fd{-1};
+};
@@ -0,0 +1,155 @@
+
+#include <assert.h>
+#include <poll.h>
+#include <algorithm>
+
+#include "stream.hpp"
+#include "pipeline.hpp"
+
+// upper limit of the data handed to a stage in one process() call
+static const size_t k_block_bytes = 65536;
+
+
+Pipeline::Pipeline(Stream &stream)
+	: m_stream(stream)
+{
+}
+
+
+Pipeline::~Pipeline()
+{
+	stop();
+}
+
+
+// Register a stage; all stages must be added before the pipeline starts
+
+void Pipeline::add(const char *name, Stage *stage)
+{
+	assert(!m_running);
+	auto r = std::make_unique<Runner>();
+	r->name = name;
+	r->stage = stage;
+	m_runners.push_back(std::move(r));
+}
+
+
+// Start the stage threads. Stage positions are kept over stop() and start(),
+// so a paused capture continues where it left off.
+
+void Pipeline::start()
+{
+	if(!m_running) {
+		m_running = true;
+		for(auto &r : m_runners) {
+			r->frame.resize(m_stream.group_count(), 0);
+			r->thread = std::thread(&Pipeline::stage_thread, this, std::ref(*r));
+		}
+	}
+}
+
+
+// Stop the stage threads after they processed all published frames
+
+void Pipeline::stop()
+{
+	if(m_running) {
+		m_running = false;
+		for(auto &r : m_runners) {
+			r->notifier.notify();
+		}
+		for(auto &r : m_runners) {
+			if(r->thread.joinable()) {
+				r->thread.join();
+			}
+		}
+	}
+}
+
+
+// Called from the capture thread after publishing new frames, never blocks
+
+void Pipeline::notify()
+{
+	for(auto &r : m_runners) {
+		r->notifier.notify();
+	}
+}
+
+
+std::vector<Pipeline::Stats> Pipeline::stats()
+{
+	std::vector<Stats> stats;
+	for(auto &r : m_runners) {
+		stats.push_back({
+			r->name,
+			r->lag.load(std::memory_order_relaxed),
+			r->lag_max.load(std::memory_order_relaxed),
+			r->frames_skipped.load(std::memory_order_relaxed),
+		});
+	}
+	return stats;
+}
+
+
+void Pipeline::stage_thread(Runner &r)
+{
+	while(true) {
+
+		bool running = m_running;
+
+		r.notifier.clear();
+		size_t lag = 0;
+		for(size_t g=0; g<r.frame.size(); g++) {
+			lag = std::max(lag, consume(r, g));
+		}
+		r.lag.store(lag, std::memory_order_relaxed);
+		if(lag > r.lag_max.load(std::memory_order_relaxed)) {
+			r.lag_max.store(lag, std::memory_order_relaxed);
+		}
+		r.stage->idle();
+
+		if(!running) break;
+
+		struct pollfd pfd = { r.notifier.fd(), POLLIN, 0 };
+		poll(&pfd, 1, 100);
+	}
+
+	r.stage->flush();
+}
+
+
+// Hand the frames published in the group ring buffer since the last call to
+// the stage, in blocks. Frames overwritten before the stage got to them are
+// skipped. Returns the number of frames the stage is behind afterwards.
+
+size_t Pipeline::consume(Runner &r, size_t g)
+{
+	Stream::Group &group = m_stream.group(g);
+	size_t frame_size = group.frame_size;
+	size_t frame_head = group.rb.head() / frame_size;
+	size_t block_frames = std::max(k_block_bytes / frame_size, (size_t)16);
+	size_t &frame = r.frame[g];
+
+	while(frame < frame_head) {
+
+		size_t used;
+		size_t pos;
+		const uint8_t *data = (const uint8_t *)group.rb.peek(&used, &pos);
+		size_t frame_oldest = pos / frame_size;
+
+		if(frame < frame_oldest) {
+			r.stage->skip(g, frame, frame_oldest - frame);
+			r.frames_skipped.fetch_add(frame_oldest - frame, std::memory_order_relaxed);
+			frame = frame_oldest;
+			continue;
+		}
+
+		size_t n = std::min(frame_head - frame, block_frames);
+		r.stage->process(g, data + (frame * frame_size - pos), frame, n);
+		frame += n;
+	}
+
+	return group.rb.head() / frame_size - frame;
+}
+
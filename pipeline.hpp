@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+
+#include "notifier.hpp"
+
+class Stream;
+
+// Stages consuming the frames the capture thread appends to the group ring
+// buffers. The capture thread only writes raw frames and calls notify();
+// every stage runs on its own thread and follows the ring heads at its own
+// pace, keeping its own position in each group. A stage falling behind by
+// more than the ring depth is told about the frames it missed through skip().
+//
+// The data passed to process() points into the ring buffer and may be
+// overwritten by the capture thread while the stage works on it; stages
+// keeping a copy must check Rb::valid() afterwards.
+
+class Pipeline {
+public:
+
+	class Stage {
+	public:
+		virtual ~Stage() = default;
+		virtual void process(size_t group, const uint8_t *data, size_t frame, size_t frame_count) = 0;
+		virtual void skip(size_t group, size_t frame, size_t frame_count) {}
+		virtual void idle() {}
+		virtual void flush() {}
+	};
+
+	struct Stats {
+		const char *name;
+		size_t lag;             // frames behind the head, worst group
+		size_t lag_max;
+		size_t frames_skipped;
+	};
+
+	Pipeline(Stream &stream);
+	~Pipeline();
+
+	void add(const char *name, Stage *stage);
+	void start();
+	void stop();
+	void notify();
+	std::vector<Stats> stats();
+
+private:
+
+	struct Runner {
+		const char *name;
+		Stage *stage;
+		std::vector<size_t> frame{};    // next frame to process per group
+		Notifier notifier{};
+		std::thread thread{};
+		std::atomic<size_t> lag{};
+		std::atomic<size_t> lag_max{};
+		std::atomic<size_t> frames_skipped{};
+	};
+
+	void stage_thread(Runner &r);
+	size_t consume(Runner &r, size_t group);
+
+	Stream &m_stream;
+	std::vector<std::unique_ptr<Runner>> m_runners{};
+	std::atomic<bool> m_running{false};
+};
+
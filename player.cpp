@@ -1,9 +1,17 @@
 
 #include <math.h>
+#include <string.h>
 
 #include "types.hpp"
 #include "stream.hpp"
 
+// history staged around the play position, in seconds
+static const Time k_history_behind = 0.1;
+static const Time k_history_ahead = 1.0;
+
+// marks the middle history set as not yet seen by the audio callback
+static const int k_history_fresh = 4;
+
 
 static void audio_callback_(void *userdata, SDL_AudioStream *stream, int additional_amount, int total_amount)
 {
@@ -173,6 +181,85 @@ void Player::seek(Time t)
 }
 
 
+// Called from the main thread while playing. Copies the frames around the
+// play position into the back history set when they are evicted from the
+// ring buffer or about to be, or need converting, and hands the set to the
+// audio callback. The reads may fault in pages of the recording, which is
+// fine here but not in the callback.
+
+void Player::stage_history()
+{
+	Config cfg = config();
+	Time t_play = m_play_pos;
+	Time t_ahead = k_history_ahead * std::max(cfg.stretch / cfg.pitch, 1.0);
+	size_t group_count = m_stream.group_count();
+	m_history_staged.resize(group_count);
+
+	auto ring_from = [&](Stream::Group &group) {
+		size_t used;
+		size_t pos;
+		group.rb.peek(&used, &pos);
+		return pos / group.rb_frame_size;
+	};
+
+	// groups converted on read are only played from the staged history
+	auto needed = [&](Stream::Group &group, size_t play, size_t ahead) {
+		return group.convert || play < ring_from(group) + ahead * 2;
+	};
+
+	// restage when history is needed or no longer needed, or the play
+	// position left the staged frames or gets close to their end
+	bool restage = false;
+	for(size_t g=0; g<group_count; g++) {
+		auto &group = m_stream.group(g);
+		size_t play = t_play * group.srate;
+		size_t ahead = t_ahead * group.srate;
+		auto [from, to] = m_history_staged[g];
+		bool need = needed(group, play, ahead);
+		bool staged = from < to;
+		if(need != staged) restage = true;
+		if(need && staged && (play < from || play + ahead / 2 > to)) restage = true;
+	}
+	if(!restage) return;
+
+	auto &back = m_history[m_history_back];
+	back.resize(group_count);
+	for(size_t g=0; g<group_count; g++) {
+		auto &group = m_stream.group(g);
+		History &h = back[g];
+		size_t play = t_play * group.srate;
+		size_t ahead = t_ahead * group.srate;
+		size_t behind = k_history_behind * group.srate;
+		h.from = h.to = 0;
+
+		if(needed(group, play, ahead)) {
+			size_t frame_from;
+			size_t frame_to;
+			m_stream.range(group.channel_first, &frame_from, &frame_to);
+			size_t from = std::max(play > behind ? play - behind : 0, frame_from);
+			size_t to = std::min(play + ahead, frame_to);
+			if(from < to) {
+				size_t stride;
+				bool in_ring;
+				size_t bytes = (to - from) * group.frame_size;
+				void *data = m_stream.read(group.channel_first, from, to - from, &stride, h.data, &in_ring);
+				if(data && data != h.data.data()) {
+					h.data.resize(bytes);
+					memcpy(h.data.data(), data, bytes);
+				}
+				if(data && (!in_ring || m_stream.read_valid(group.channel_first, from))) {
+					h.from = from;
+					h.to = to;
+				}
+			}
+		}
+		m_history_staged[g] = { h.from, h.to };
+	}
+
+	m_history_back = m_history_mid.exchange(m_history_back | k_history_fresh, std::memory_order_acq_rel) & 3;
+}
+
+
 void Player::audio_callback(SDL_AudioStream *stream, int additional_amount, int total_amount)
 {
 
@@ -184,10 +271,6 @@ void Player::audio_callback(SDL_AudioStream *stream, int additional_amount, int
 	size_t frame_count = total_amount / m_frame_size;
 	if(frame_count > m_buf_frames) frame_count = m_buf_frames;
 
-	size_t stride = 0;
-	size_t avail = 0;
-	Sample *data = m_stream.peek(&stride, &avail);
-
 	// TODO: precalculate
 
 	std::vector<float> gain[2];
@@ -204,64 +287,150 @@ void Player::audio_callback(SDL_AudioStream *stream, int additional_amount, int
 		enabled[ch] = ccfg.enabled;
 	}
 
+	// pick up newly staged history
+	if(m_history_mid.load(std::memory_order_acquire) & k_history_fresh) {
+		m_history_front = m_history_mid.exchange(m_history_front, std::memory_order_acq_rel) & 3;
+	}
+	auto &history = m_history[m_history_front];
+
+	// available range of each channel group: the ring buffer and the
+	// staged history. Playback indices count absolute frames at the stream
+	// rate, groups at other rates are read with linear interpolation.
+
+	m_spans.resize(m_stream.group_count());
+	m_channel_group.resize(m_stream.channel_count());
+	m_windows.resize(m_stream.group_count() * 2);
+	for(size_t g=0; g<m_stream.group_count(); g++) {
+		auto &group = m_stream.group(g);
+		Span &s = m_spans[g];
+		size_t used;
+		size_t pos;
+		s.ring = (const uint8_t *)group.rb.peek(&used, &pos);
+		s.ring_from = pos / group.rb_frame_size;
+		s.from = s.ring_from;
+		s.to = (pos + used) / group.rb_frame_size;
+		if(group.convert) s.ring = nullptr;
+		if(g < history.size() && history[g].from < history[g].to) {
+			s.from = std::min(s.from, history[g].from);
+		}
+		s.ratio = group.srate / m_srate;
+		s.window = frame_count * s.ratio + 2;
+		s.idx_oldest = SIZE_MAX;
+		for(size_t ch=0; ch<group.channel_count; ch++) {
+			m_channel_group[group.channel_first + ch] = g;
+		}
+		for(size_t w=0; w<2; w++) {
+			m_windows[g * 2 + w].from = m_windows[g * 2 + w].to = 0;
+		}
+	}
+
 	size_t xfade_samples = m_srate * 0.030 * cfg.pitch;
 	float factor = cfg.stretch / cfg.pitch;
 
-	for(size_t i=0; i<frame_count; i++) {
-
-		// handle seeking and crossfade
-
-		Time delta = fabs(m_play_pos - (Time(m_idx) / m_srate));
-		if(delta > 0.020 || cfg.stretch != 1.0f) {
-			if(m_xfade == 0) {
-				m_idx_prev = m_idx;
-				m_idx = m_play_pos * m_srate;
-				m_xfade = xfade_samples;
+	sample_dispatch(m_stream.sample_type(), nullptr, [&](auto *type) {
+		using T = std::remove_cvref_t<decltype(*type)>;
+		constexpr float scale = 1.0f / SampleTraits<T>::max;
+
+		// read channel ch at stream frame idx through one of the two windows
+		// of its group, one following the current and one the previous
+		// position while crossfading. false if not available
+		auto read = [&](size_t ch, size_t idx, size_t slot, float *v) {
+			size_t g = m_channel_group[ch];
+			Span &s = m_spans[g];
+			double pos = idx * s.ratio;
+			size_t i0 = pos;
+			if(i0 < s.from || i0 >= s.to) return false;
+			size_t i1 = std::min(i0 + 1, s.to - 1);
+			Window &w = m_windows[g * 2 + slot];
+			if(i0 < w.from || i1 >= w.to) {
+				auto &group = m_stream.group(g);
+				const History *h = g < history.size() ? &history[g] : nullptr;
+				w.from = i0;
+				w.stride = group.channel_count;
+				if(h && i0 >= h->from && i0 < h->to) {
+					w.to = std::min(i0 + s.window, h->to);
+					w.data = h->data.data() + (i0 - h->from) * group.frame_size;
+				} else if(s.ring && i0 >= s.ring_from) {
+					w.to = std::min(i0 + s.window, s.to);
+					w.data = s.ring + (i0 - s.ring_from) * group.frame_size;
+					s.idx_oldest = std::min(s.idx_oldest, w.from);
+				} else {
+					w.to = w.from;
+					return false;
+				}
+			}
+			if(i1 >= w.to) i1 = i0;
+			size_t ch_off = ch - m_stream.group(g).channel_first;
+			const T *frames = (const T *)w.data + ch_off;
+			float f = pos - i0;
+			*v = (frames[(i0 - w.from) * w.stride] * (1.0f - f) +
+			      frames[(i1 - w.from) * w.stride] * f) * scale;
+			return true;
+		};
+
+		for(size_t i=0; i<frame_count; i++) {
+
+			// handle seeking and crossfade
+
+			Time delta = fabs(m_play_pos - (Time(m_idx) / m_srate));
+			if(delta > 0.020 || cfg.stretch != 1.0f) {
+				if(m_xfade == 0) {
+					m_idx_prev = m_idx;
+					m_idx = m_play_pos * m_srate;
+					m_xfade = xfade_samples;
+				}
 			}
-		}
 
-		float v[2]{};
-		float g0 = (float)m_xfade / (float)xfade_samples;
-		float g1 = (1.0f - g0);
+			float v[2]{};
+			float g0 = (float)m_xfade / (float)xfade_samples;
+			float g1 = (1.0f - g0);
 
-		// mix source channels into L/R playback channels
+			// mix source channels into L/R playback channels
 
-		for(size_t ch=0; ch<m_stream.channel_count(); ch++) {
-			if(enabled[ch] && m_idx >= 0 && m_idx < avail) {
-				float v_ch = data[m_idx * stride + ch] / (float)k_sample_max;
-				if(m_xfade > 0) {
-					if(m_idx_prev >= 0 && m_idx_prev < avail) {
-						float v_prev = data[m_idx_prev * stride + ch] / (float)k_sample_max;
+			for(size_t ch=0; ch<m_stream.channel_count(); ch++) {
+				float v_ch;
+				if(enabled[ch] && read(ch, m_idx, 0, &v_ch)) {
+					float v_prev;
+					if(m_xfade > 0 && read(ch, m_idx_prev, 1, &v_prev)) {
 						v_ch = v_prev * g0 + v_ch * g1;
 					}
-				}
-				for(size_t lr=0; lr<2; lr++) {
-					v[lr] += v_ch * gain[lr][ch] * master_gain;
+					for(size_t lr=0; lr<2; lr++) {
+						v[lr] += v_ch * gain[lr][ch] * master_gain;
+					}
 				}
 			}
-		}
 
-		if(m_xfade > 0) {
-			m_xfade --;
-		}
+			if(m_xfade > 0) {
+				m_xfade --;
+			}
 	
-		// post processing
+			// post processing
 
-		for(size_t lr=0; lr<2; lr++) {
+			for(size_t lr=0; lr<2; lr++) {
 		
-			if(cfg.shift != 0.0f) {
-				v[lr] = m_freqshift[lr].run(v[lr]);
-			}
+				if(cfg.shift != 0.0f) {
+					v[lr] = m_freqshift[lr].run(v[lr]);
+				}
 
-			if(cfg.freq_hp >     0.0) v[lr] = m_filter[lr].fir_hp.run(v[lr]);
-			if(cfg.freq_lp < m_srate) v[lr] = m_filter[lr].fir_lp.run(v[lr]);
+				if(cfg.freq_hp >     0.0) v[lr] = m_filter[lr].fir_hp.run(v[lr]);
+				if(cfg.freq_lp < m_srate) v[lr] = m_filter[lr].fir_lp.run(v[lr]);
 		
-			m_buf[i*2 + lr] = v[lr];
-		}
+				m_buf[i*2 + lr] = v[lr];
+			}
 
-		m_idx ++;
-		m_idx_prev ++;
-		m_play_pos += 1.0 / m_srate * factor; 
+			m_idx ++;
+			m_idx_prev ++;
+			m_play_pos += 1.0 / m_srate * factor; 
+		}
+	});
+
+	// mute the block if the capture thread overwrote the data while mixing
+	for(size_t g=0; g<m_spans.size(); g++) {
+		Span &s = m_spans[g];
+		size_t ch = m_stream.group(g).channel_first;
+		if(s.idx_oldest != SIZE_MAX && !m_stream.read_valid(ch, s.idx_oldest)) {
+			std::fill(m_buf.begin(), m_buf.begin() + frame_count * 2, 0.0f);
+		}
 	}
 
 	SDL_SetAudioStreamFrequencyRatio(m_sdl_audio_stream, cfg.pitch);
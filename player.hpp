@@ -3,6 +3,8 @@
 
 #include <atomic>
 #include <algorithm>
+#include <vector>
+#include <utility>
 
 #include <SDL3/SDL.h>
 
@@ -51,6 +53,7 @@ public:
 	void pause();
 	void resume();
 	void seek(Time tpos);
+	void stage_history();
 	void audio_callback(SDL_AudioStream *stream, int additional_amount, int total_amount);
 
 private:
@@ -68,6 +71,40 @@ private:
 	size_t m_frame_size;
 	size_t m_buf_frames;
 	std::vector<float> m_buf{};
+	struct Span {
+		size_t from;
+		size_t to;
+		size_t ring_from;
+		const uint8_t *ring;
+		double ratio;
+		size_t window;
+		size_t idx_oldest;
+	};
+	std::vector<Span> m_spans{};
+	std::vector<size_t> m_channel_group{};
+	struct Window {
+		size_t from;
+		size_t to;
+		const void *data;
+		size_t stride;
+	};
+	std::vector<Window> m_windows{};
+
+	// Frames around the play position copied out of the recording by the
+	// main thread, so the audio callback never touches the disk mapping.
+	// Handed over through a triple buffer: the main thread fills the back
+	// set and swaps it with the middle one, the callback swaps the middle
+	// one for its front set when it is marked fresh.
+	struct History {
+		size_t from{};
+		size_t to{};
+		std::vector<uint8_t> data{};
+	};
+	std::vector<History> m_history[3]{};
+	int m_history_back{0};
+	int m_history_front{2};
+	std::atomic<int> m_history_mid{1};
+	std::vector<std::pair<size_t, size_t>> m_history_staged{};
 	struct {
 		Fir fir_lp{127};
 		Fir fir_hp{127};
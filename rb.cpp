@@ -7,6 +7,7 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <sys/types.h>
+#include <errno.h>
 
 #include "rb.hpp"
 
@@ -21,29 +22,121 @@ Rb::~Rb()
 }
 
 
-void Rb::set_size(size_t size)
+void Rb::set_size(size_t size, int flags)
 {
 	clear();
 
-	// round up to multiple of page size
-	size_t page_size = sysconf(_SC_PAGE_SIZE);
+	if(flags & HugePages) {
+		if(map(size, true)) {
+			m_huge = true;
+		} else {
+			fprintf(stderr, "rb: hugetlb pages not available, using transparent huge pages\n");
+		}
+	}
+
+	if(!m_huge) {
+		bool ok = map(size, false);
+		assert(ok);
+		if(flags & HugePages) {
+			madvise(m_map1, m_size * 2, MADV_HUGEPAGE);
+		}
+	}
+
+	if(flags & (Prefault | Lock)) {
+		m_prefault_stop = false;
+		m_prefault_thread = std::thread(&Rb::prefault, this, flags);
+	}
+}
+
+
+// Create the memfd and map it twice side by side, optionally from the
+// hugetlb pool. Both maps must be aligned to the page size used.
+
+bool Rb::map(size_t size, bool huge)
+{
+	size_t page_size = huge ? k_huge_page_size : sysconf(_SC_PAGE_SIZE);
 	size = (size + page_size - 1) & ~(page_size - 1);
+
+	int fd = memfd_create("rb", MFD_CLOEXEC | (huge ? MFD_HUGETLB : 0));
+	if(fd == -1) return false;
+	if(ftruncate(fd, size) != 0) {
+		close(fd);
+		return false;
+	}
+
+	// reserve address space for both maps plus alignment slack
+	size_t len = size * 2 + page_size;
+	uint8_t *addr = (uint8_t *)mmap(nullptr, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(addr != MAP_FAILED);
+	uint8_t *addr1 = (uint8_t *)(((uintptr_t)addr + page_size - 1) & ~(page_size - 1));
+	uint8_t *addr2 = addr1 + size;
+	if(addr1 > addr) munmap(addr, addr1 - addr);
+	munmap(addr2 + size, addr + len - (addr2 + size));
+
+	void *map1 = mmap(addr1, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, 0);
+	void *map2 = mmap(addr2, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, fd, 0);
+	if(map1 == MAP_FAILED || map2 == MAP_FAILED) {
+		munmap(addr1, size * 2);
+		close(fd);
+		return false;
+	}
+
+	m_fd = fd;
 	m_size = size;
+	m_map1 = addr1;
+	m_map2 = addr2;
+	return true;
+}
+
+
+// Fault in all pages ahead of the capture thread, so writing to a fresh
+// buffer does not stall on page faults. Pages are only read: capture may
+// already be writing to the buffer.
 
-	// create memfd with enough space for two copies of the buffer
-	m_fd = memfd_create("rb", MFD_CLOEXEC);
-	assert(m_fd != -1);
-	int r = ftruncate(m_fd, size * 2);
-	assert(r == 0);
-
-	// map two regions side by side
-	void *addr1 = mmap(nullptr, size * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	void *addr2 = (uint8_t *)addr1 + size;
-	assert(addr1 != MAP_FAILED);
-	m_map1 = (uint8_t *)mmap(addr1, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, m_fd, 0);
-	assert(m_map1 != MAP_FAILED);
-	m_map2 = (uint8_t *)mmap(addr2, size, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_SHARED, m_fd, 0);
-	assert(m_map2 != MAP_FAILED);
+void Rb::prefault(int flags)
+{
+	if(flags & Lock) {
+		if(mlock(m_map1, m_size * 2) != 0) {
+			fprintf(stderr, "rb: mlock failed: %s\n", strerror(errno));
+		}
+		return;
+	}
+
+#ifdef MADV_POPULATE_WRITE
+	if(madvise(m_map1, m_size * 2, MADV_POPULATE_WRITE) == 0) {
+		return;
+	}
+#endif
+
+	size_t page_size = sysconf(_SC_PAGE_SIZE);
+	for(size_t i=0; i<m_size * 2 && !m_prefault_stop; i+=page_size) {
+		(void)*(volatile uint8_t *)(m_map1 + i);
+	}
+}
+
+
+// Back the buffer with a read-only mapping of len bytes of a file, starting
+// at offset. The buffer is full from the start and must not be written to.
+
+bool Rb::map_file(int fd, size_t offset, size_t len)
+{
+	clear();
+
+	size_t page_size = sysconf(_SC_PAGE_SIZE);
+	size_t map_offset = offset & ~(page_size - 1);
+	size_t map_len = len + (offset - map_offset);
+
+	void *addr = mmap(nullptr, map_len, PROT_READ, MAP_SHARED, fd, map_offset);
+	if(addr == MAP_FAILED) {
+		return false;
+	}
+
+	m_file_map = (uint8_t *)addr;
+	m_file_map_len = map_len;
+	m_map1 = m_file_map + (offset - map_offset);
+	m_size = len;
+	m_head.store(len, std::memory_order_release);
+	return true;
 }
 
 
@@ -55,6 +148,15 @@ size_t Rb::size()
 
 void Rb::clear()
 {
+	if(m_prefault_thread.joinable()) {
+		m_prefault_stop = true;
+		m_prefault_thread.join();
+	}
+	if(m_file_map != nullptr) {
+		munmap(m_file_map, m_file_map_len);
+		m_file_map = nullptr;
+		m_map1 = nullptr;
+	}
 	if(m_fd != -1) {
 		close(m_fd);
 		m_fd = -1;
@@ -68,46 +170,79 @@ void Rb::clear()
 		m_map2 = nullptr;
 	}
 	m_size = 0;
-	m_head = 0;
-	m_tail = 0;
+	m_huge = false;
+	m_head.store(0);
+	m_tail.store(0);
 }
 
 
 size_t Rb::bytes_used()
 {
-	assert(m_head >= m_tail && "rb underflow");
-	return m_head - m_tail;
+	size_t tail = m_tail.load(std::memory_order_acquire);
+	size_t head = m_head.load(std::memory_order_acquire);
+	assert(head >= tail && "rb underflow");
+	return head - tail;
 }
 
 
+// Reserve len bytes at the head for writing. Data about to be overwritten is
+// retired by moving the tail before the caller touches it, so readers can
+// detect torn reads with valid(). Single writer only.
 
-void *Rb::write_ptr(size_t *bytes_max)
+void *Rb::write_ptr(size_t len, size_t *bytes_max)
 {
-	assert(m_head >= m_tail && "rb underflow");
-	if(bytes_max) *bytes_max = m_size - bytes_used();
-	size_t write_idx = m_head % m_size;
+	assert(len <= m_size && "rb overflow");
+	assert(m_file_map == nullptr && "rb is read-only");
+	size_t head = m_head.load(std::memory_order_relaxed);
+	size_t tail = m_tail.load(std::memory_order_relaxed);
+	if(head + len - tail > m_size) {
+		m_tail.store(head + len - m_size, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+	if(bytes_max) *bytes_max = m_size - (head - m_tail.load(std::memory_order_relaxed));
+	size_t write_idx = head % m_size;
 	return m_map1 + write_idx;
 }
 
 
+// Publish len bytes written at the head to the readers
+
 void Rb::write_done(size_t len)
 {
 	assert(len <= m_size && "rb overflow");
-	m_head += len;
-	if(m_head - m_tail > m_size) {
-		m_tail = m_head - m_size;
+	size_t head = m_head.load(std::memory_order_relaxed) + len;
+	if(head - m_tail.load(std::memory_order_relaxed) > m_size) {
+		m_tail.store(head - m_size, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
 	}
+	m_head.store(head, std::memory_order_release);
 }
 
 
-void *Rb::peek(size_t *used)
+// Snapshot of the readable data; pos returns the absolute position of the
+// returned pointer for checking with valid() after reading
+
+void *Rb::peek(size_t *used, size_t *pos)
 {
-	assert(m_head >= m_tail && "rb underflow");
-	if (used) {
-		*used = m_head - m_tail;
-	}
-	size_t read_idx = m_tail % m_size;
+	size_t head, tail;
+	do {
+		tail = m_tail.load(std::memory_order_acquire);
+		head = m_head.load(std::memory_order_acquire);
+	} while(tail != m_tail.load(std::memory_order_acquire));
+
+	assert(head >= tail && "rb underflow");
+	if(used) *used = head - tail;
+	if(pos) *pos = tail;
+	size_t read_idx = tail % m_size;
 	return m_map1 + read_idx;
 }
 
 
+// True if the data at absolute position pos has not been retired by the writer
+
+bool Rb::valid(size_t pos)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return pos >= m_tail.load(std::memory_order_relaxed);
+}
+
@@ -1,32 +1,51 @@
-
 #pragma once
 
 #include <stdint.h>
+#include <atomic>
+#include <thread>
 
 class Rb {
 
 public:
+	enum Flags {
+		HugePages = 1 << 0,     // back with huge pages, falls back to THP advice
+		Prefault = 1 << 1,      // fault in all pages on a background thread
+		Lock = 1 << 2,          // mlock the buffer, implies prefault
+	};
+
 	Rb();
 	~Rb();
-	void set_size(size_t size);
+	void set_size(size_t size, int flags = 0);
+	bool map_file(int fd, size_t offset, size_t len);
 	size_t size();
 
 	size_t bytes_used();
+	size_t head() { return m_head.load(std::memory_order_acquire); }
 
-	void *write_ptr(size_t *bytes_max = nullptr);
+	void *write_ptr(size_t len, size_t *bytes_max = nullptr);
 	void write_done(size_t len);
 
-	void *peek(size_t *used = nullptr);
+	void *peek(size_t *used = nullptr, size_t *pos = nullptr);
+	bool valid(size_t pos);
 
 
 private:
 
 	void clear();
+	bool map(size_t size, bool huge);
+	void prefault(int flags);
+
+	static const size_t k_huge_page_size = 2 * 1024 * 1024;
 
 	int m_fd{-1};
 	size_t m_size{};
-	size_t m_head{};
-	size_t m_tail{};
+	std::atomic<size_t> m_head{};
+	std::atomic<size_t> m_tail{};
 	uint8_t *m_map1{};
 	uint8_t *m_map2{};
+	uint8_t *m_file_map{};
+	size_t m_file_map_len{};
+	bool m_huge{false};
+	std::thread m_prefault_thread;
+	std::atomic<bool> m_prefault_stop{false};
 };
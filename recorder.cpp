@@ -0,0 +1,384 @@
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <algorithm>
+
+#include "stream.hpp"
+#include "recorder.hpp"
+
+static_assert(sizeof(Recorder::ChunkHeader) <= 4096);
+
+static const char k_magic[8] = { 'F', 'F', 'T', 'R', 'E', 'C', '0', '1' };
+
+// interval at which the index files are flushed to disk
+static const Time k_sync_interval = 1.0;
+
+
+static int64_t walltime_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+// FNV-1a over 64 bit words; len must be a multiple of 8
+
+static uint64_t checksum(const void *data, size_t len)
+{
+	const uint64_t *p = (const uint64_t *)data;
+	uint64_t h = 0xcbf29ce484222325;
+	for(size_t i=0; i<len/8; i++) {
+		h = (h ^ p[i]) * 0x100000001b3;
+	}
+	return h;
+}
+
+
+Recorder::Recorder(Stream &stream)
+	: m_stream(stream)
+{
+}
+
+
+Recorder::~Recorder()
+{
+	close();
+}
+
+
+// Create the first data segment PATH.N.0.rec and an index file PATH.N.idx
+// for each channel group and register the recorder as pipeline stage. Must
+// be called after the stream is allocated.
+
+bool Recorder::open(const char *path)
+{
+	close();
+
+	for(size_t g=0; g<m_stream.group_count(); g++) {
+		m_writers.emplace_back();
+		Writer &w = m_writers.back();
+		char fname[PATH_MAX];
+
+		snprintf(fname, sizeof(fname), "%s.%zu", path, g);
+		w.path = fname;
+		if(!open_segment(w)) {
+			close();
+			return false;
+		}
+
+		snprintf(fname, sizeof(fname), "%s.%zu.idx", path, g);
+		w.idx = fopen(fname, "wb");
+		if(w.idx == nullptr) {
+			fprintf(stderr, "error: %s: %s\n", fname, strerror(errno));
+			close();
+			return false;
+		}
+
+		int r = posix_memalign((void **)&w.buf, k_align, k_chunk_bytes);
+		assert(r == 0);
+	}
+
+	m_t_sync = hirestime();
+	m_stream.pipeline.add("recorder", this);
+	return true;
+}
+
+
+void Recorder::close()
+{
+	for(auto &w : m_writers) {
+		if(w.fd != -1) ::close(w.fd);
+		for(auto &s : w.segments) {
+			if(s.map) munmap(s.map, k_segment_bytes);
+			if(s.fd_map != -1) ::close(s.fd_map);
+		}
+		if(w.idx) fclose(w.idx);
+		free(w.buf);
+	}
+	m_writers.clear();
+}
+
+
+// Continue writing in the next data segment PATH.N.M.rec. The mapping
+// reserves address space for the segment to grow into, only ranges of
+// completed chunks are ever accessed.
+
+bool Recorder::open_segment(Writer &w)
+{
+	char fname[PATH_MAX];
+	snprintf(fname, sizeof(fname), "%s.%zu.rec", w.path.c_str(), w.segments.size());
+
+	if(w.fd != -1) ::close(w.fd);
+	w.fd = ::open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC, 0644);
+	if(w.fd == -1 && errno == EINVAL) {
+		fprintf(stderr, "%s: direct I/O not supported, using buffered I/O\n", fname);
+		w.fd = ::open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	}
+	if(w.fd == -1) {
+		fprintf(stderr, "error: %s: %s\n", fname, strerror(errno));
+		return false;
+	}
+
+	Segment s = { ::open(fname, O_RDONLY | O_CLOEXEC), nullptr };
+	if(s.fd_map != -1) {
+		void *map = mmap(nullptr, k_segment_bytes, PROT_READ, MAP_SHARED | MAP_NORESERVE, s.fd_map, 0);
+		if(map != MAP_FAILED) s.map = (uint8_t *)map;
+	}
+	if(s.map == nullptr) {
+		fprintf(stderr, "%s: can not map, history is limited to the ring buffer\n", fname);
+	}
+
+	std::lock_guard<std::mutex> lock(m_chunks_mutex);
+	w.segments.push_back(s);
+	w.offset = 0;
+	return true;
+}
+
+
+Recorder::Stats Recorder::stats()
+{
+	return {
+		m_bytes_written.load(std::memory_order_relaxed),
+		m_frames_lost.load(std::memory_order_relaxed),
+		m_errors.load(std::memory_order_relaxed),
+	};
+}
+
+
+// Sync the index files to disk now and then
+
+void Recorder::idle()
+{
+	Time t = hirestime();
+	if(t - m_t_sync > k_sync_interval) {
+		for(auto &w : m_writers) {
+			fflush(w.idx);
+			fdatasync(fileno(w.idx));
+		}
+		m_t_sync = t;
+	}
+}
+
+
+// Write out the partial chunks when the pipeline stops
+
+void Recorder::flush()
+{
+	for(size_t g=0; g<m_writers.size(); g++) {
+		if(m_writers[g].chunk_frames > 0) {
+			write_chunk(g);
+		}
+		fflush(m_writers[g].idx);
+		fdatasync(m_writers[g].fd);
+		fdatasync(fileno(m_writers[g].idx));
+	}
+}
+
+
+// Copy frames from the group ring buffer into the chunk buffer, writing out
+// every chunk that fills up. If the capture thread overwrote the frames while
+// they were copied the rest of the block is counted as lost and ends the
+// current chunk.
+
+void Recorder::process(size_t g, const uint8_t *data, size_t frame, size_t frame_count)
+{
+	Writer &w = m_writers[g];
+	Stream::Group &group = m_stream.group(g);
+	size_t frame_size = group.frame_size;
+	size_t frames_max = (k_chunk_bytes - k_align) / frame_size;
+
+	while(frame_count > 0) {
+
+		if(w.chunk_frames == 0) {
+			size_t frame_head = group.rb.head() / frame_size;
+			w.chunk_frame = frame;
+			w.t_wall_ns = walltime_ns() - (int64_t)((frame_head - frame) * 1e9 / group.srate);
+		}
+
+		size_t n = std::min(frame_count, frames_max - w.chunk_frames);
+		memcpy(w.buf + k_align + w.chunk_frames * frame_size, data, n * frame_size);
+
+		// the copy is only good if the start was not overwritten meanwhile
+		if(!group.rb.valid(frame * frame_size)) {
+			skip(g, frame, frame_count);
+			return;
+		}
+
+		w.chunk_frames += n;
+		frame += n;
+		frame_count -= n;
+		data += n * frame_size;
+
+		if(w.chunk_frames == frames_max) {
+			write_chunk(g);
+		}
+	}
+}
+
+
+// Frames overwritten before they were recorded end the current chunk, the
+// next chunk starts after the gap
+
+void Recorder::skip(size_t g, size_t frame, size_t frame_count)
+{
+	if(m_writers[g].chunk_frames > 0) {
+		write_chunk(g);
+	}
+	m_frames_lost.fetch_add(frame_count, std::memory_order_relaxed);
+	m_stream.group(g).discontinuities.add(frame, frame_count, Discontinuities::Cause::Overwrite);
+}
+
+
+void Recorder::write_chunk(size_t g)
+{
+	Writer &w = m_writers[g];
+	Stream::Group &group = m_stream.group(g);
+
+	size_t data_bytes = w.chunk_frames * group.frame_size;
+	size_t payload_bytes = (data_bytes + k_align - 1) / k_align * k_align;
+	memset(w.buf + k_align + data_bytes, 0, payload_bytes - data_bytes);
+	memset(w.buf, 0, k_align);
+
+	ChunkHeader *h = (ChunkHeader *)w.buf;
+	memcpy(h->magic, k_magic, sizeof(k_magic));
+	h->group = g;
+	h->channel_count = group.channel_count;
+	h->sample_type = (uint32_t)m_stream.sample_type();
+	h->srate = group.srate;
+	h->frame = w.chunk_frame;
+	h->frame_count = w.chunk_frames;
+	h->t_wall_ns = w.t_wall_ns;
+	h->payload_bytes = payload_bytes;
+	h->payload_sum = checksum(w.buf + k_align, payload_bytes);
+	h->header_sum = checksum(h, offsetof(ChunkHeader, header_sum));
+
+	// start a new segment when the chunk does not fit in the mapping
+	size_t len = k_align + payload_bytes;
+	ssize_t r = -1;
+	if((w.fd != -1 && w.offset + len <= k_segment_bytes) || open_segment(w)) {
+		r = pwrite(w.fd, w.buf, len, w.offset);
+		if(r == -1 && errno == EINVAL) {
+			// the file system refused direct I/O after all
+			fcntl(w.fd, F_SETFL, fcntl(w.fd, F_GETFL) & ~O_DIRECT);
+			r = pwrite(w.fd, w.buf, len, w.offset);
+		}
+	}
+
+	if(r == (ssize_t)len) {
+		uint32_t segment = w.segments.size() - 1;
+		IndexEntry e = { w.chunk_frame, w.chunk_frames, w.t_wall_ns, w.offset, segment, 0 };
+		fwrite(&e, sizeof(e), 1, w.idx);
+		if(w.segments.back().map) {
+			std::lock_guard<std::mutex> lock(m_chunks_mutex);
+			w.chunks.push_back(e);
+		}
+		w.offset += len;
+		m_bytes_written.fetch_add(len, std::memory_order_relaxed);
+	} else {
+		fprintf(stderr, "recorder: write failed: %s\n", r == -1 ? strerror(errno) : "short write");
+		m_errors.fetch_add(1, std::memory_order_relaxed);
+		m_frames_lost.fetch_add(w.chunk_frames, std::memory_order_relaxed);
+	}
+
+	w.chunk_frames = 0;
+}
+
+
+
+// Chunk holding the given frame, or the next chunk after it. Chunks are
+// appended in frame order. Called with m_chunks_mutex held.
+
+const Recorder::IndexEntry *Recorder::find(Writer &w, size_t frame)
+{
+	auto it = std::upper_bound(w.chunks.begin(), w.chunks.end(), frame,
+			[](size_t f, const IndexEntry &e) { return f < e.frame; });
+	if(it != w.chunks.begin()) {
+		auto &e = *(it - 1);
+		if(frame < e.frame + e.frame_count) return &e;
+	}
+	return it != w.chunks.end() ? &*it : nullptr;
+}
+
+
+// Pointer to the given group frame in the mapped data file. frame_count is
+// set to the number of frames following it in the same chunk. If the frame
+// was not recorded, nullptr is returned and frame_count is set to the number
+// of frames up to the next recorded frame, or SIZE_MAX if there is none.
+
+const uint8_t *Recorder::map(size_t group, size_t frame, size_t *frame_count)
+{
+	*frame_count = SIZE_MAX;
+	if(group >= m_writers.size()) return nullptr;
+	Writer &w = m_writers[group];
+
+	std::lock_guard<std::mutex> lock(m_chunks_mutex);
+	const IndexEntry *e = find(w, frame);
+	if(e == nullptr) return nullptr;
+	if(frame < e->frame) {
+		*frame_count = e->frame - frame;
+		return nullptr;
+	}
+	size_t frame_size = m_stream.group(group).frame_size;
+	*frame_count = e->frame + e->frame_count - frame;
+	const Segment &s = w.segments[e->segment];
+	if(s.map == nullptr || e->offset + k_align + e->frame_count * frame_size > k_segment_bytes) {
+		return nullptr;
+	}
+	return s.map + e->offset + k_align + (frame - e->frame) * frame_size;
+}
+
+
+size_t Recorder::frame_first(size_t group)
+{
+	if(group >= m_writers.size()) return SIZE_MAX;
+	std::lock_guard<std::mutex> lock(m_chunks_mutex);
+	auto &chunks = m_writers[group].chunks;
+	return chunks.empty() ? SIZE_MAX : chunks.front().frame;
+}
+
+
+// Start reading the chunks holding the given frames into the page cache,
+// one range per segment
+
+void Recorder::prefetch(size_t group, size_t frame_from, size_t frame_to)
+{
+	if(group >= m_writers.size()) return;
+	Writer &w = m_writers[group];
+	size_t frame_size = m_stream.group(group).frame_size;
+
+	struct Extent {
+		uint8_t *map;
+		size_t from;
+		size_t to;
+	};
+	std::vector<Extent> extents;
+	{
+		std::lock_guard<std::mutex> lock(m_chunks_mutex);
+		const IndexEntry *e = find(w, frame_from);
+		const IndexEntry *end = w.chunks.data() + w.chunks.size();
+		for(; e && e < end && e->frame < frame_to; e++) {
+			uint8_t *map = w.segments[e->segment].map;
+			size_t payload = (e->frame_count * frame_size + k_align - 1) / k_align * k_align;
+			size_t from = e->offset;
+			size_t to = std::min(from + k_align + payload, k_segment_bytes);
+			if(extents.empty() || extents.back().map != map) {
+				extents.push_back({ map, from, to });
+			} else {
+				extents.back().to = std::max(extents.back().to, to);
+			}
+		}
+	}
+
+	for(auto &x : extents) {
+		if(x.map && x.from < x.to) {
+			madvise(x.map + x.from, x.to - x.from, MADV_WILLNEED);
+		}
+	}
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
+
+#include "types.hpp"
+#include "pipeline.hpp"
+
+class Stream;
+
+// Background recorder writing all channel groups to disk for captures longer
+// than the ring buffer depth. It runs as a pipeline stage, copying frames out
+// of the group ring buffers and appending self-describing chunks with direct
+// I/O, so the capture thread never waits for the disk. Frames the recorder
+// could not copy before the capture thread overwrote them show up as a gap in
+// the frame numbers of the chunks.
+//
+// The data is split in segment files of at most k_segment_bytes, so that
+// each can be mapped read-only in one go to serve frames that have been
+// evicted from the ring buffers, with the page cache acting as the cache.
+
+class Recorder : public Pipeline::Stage {
+public:
+
+	// Chunk header, padded to k_align and followed by the payload, which
+	// is padded to k_align as well. A chunk is valid if its magic, header
+	// sum and payload sum match, so a crash leaves at most a torn last
+	// chunk which readers skip.
+	struct ChunkHeader {
+		char magic[8];          // "FFTREC01"
+		uint32_t group;
+		uint32_t channel_count;
+		uint32_t sample_type;   // SampleType
+		uint32_t reserved;
+		double srate;
+		uint64_t frame;         // group frame number of the first frame
+		uint64_t frame_count;
+		int64_t t_wall_ns;      // CLOCK_REALTIME of the first frame
+		uint64_t payload_bytes;
+		uint64_t payload_sum;
+		uint64_t header_sum;    // over all preceding fields
+	};
+
+	// One entry per chunk, appended to the index file next to the data
+	struct IndexEntry {
+		uint64_t frame;
+		uint64_t frame_count;
+		int64_t t_wall_ns;
+		uint64_t offset;        // segment file offset of the chunk header
+		uint32_t segment;
+		uint32_t reserved;
+	};
+
+	struct Stats {
+		size_t bytes_written;
+		size_t frames_lost;
+		size_t errors;
+	};
+
+	Recorder(Stream &stream);
+	~Recorder();
+
+	bool open(const char *path);
+	bool is_open() { return !m_writers.empty(); }
+	Stats stats();
+
+	void process(size_t group, const uint8_t *data, size_t frame, size_t frame_count) override;
+	void skip(size_t group, size_t frame, size_t frame_count) override;
+	void idle() override;
+	void flush() override;
+
+	const uint8_t *map(size_t group, size_t frame, size_t *frame_count);
+	size_t frame_first(size_t group);
+	void prefetch(size_t group, size_t frame_from, size_t frame_to);
+
+private:
+
+	static const size_t k_align = 4096;
+	static const size_t k_chunk_bytes = 4 * 1024 * 1024;
+	static const size_t k_segment_bytes = (size_t)1 << 36;
+
+	struct Segment {
+		int fd_map;
+		uint8_t *map;           // read-only mapping of the whole segment
+	};
+
+	struct Writer {
+		std::string path{};
+		int fd{-1};
+		std::vector<Segment> segments{};
+		std::vector<IndexEntry> chunks{};
+		FILE *idx{};
+		uint64_t offset{};      // write offset in the current segment
+		uint8_t *buf{};
+		size_t chunk_frame{};    // group frame of the first frame in buf
+		size_t chunk_frames{};
+		int64_t t_wall_ns{};
+	};
+
+	void close();
+	bool open_segment(Writer &w);
+	void write_chunk(size_t group);
+	const IndexEntry *find(Writer &w, size_t frame);
+
+	Stream &m_stream;
+	std::vector<Writer> m_writers{};
+	std::mutex m_chunks_mutex;
+	Time m_t_sync{};
+
+	std::atomic<size_t> m_bytes_written{};
+	std::atomic<size_t> m_frames_lost{};
+	std::atomic<size_t> m_errors{};
+};
+
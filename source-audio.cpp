@@ -10,6 +10,7 @@ public:
 
 	void open() override;
 	void resume() override;
+	bool realtime() override { return true; }
 	void pause() override;
 };
 
@@ -28,6 +29,13 @@ SourceAudio::~SourceAudio()
 }
 
 
+static void put_callback(void *userdata, SDL_AudioStream *stream, int additional_amount, int total_amount)
+{
+	SourceAudio *source = (SourceAudio *)userdata;
+	source->notify();
+}
+
+
 void SourceAudio::open()
 {
 	m_sdl_stream = SDL_OpenAudioDeviceStream(
@@ -35,6 +43,7 @@ void SourceAudio::open()
             &m_dst_spec, nullptr, (void *)this);
 
 	if(m_sdl_stream) {
+		SDL_SetAudioStreamPutCallback(m_sdl_stream, put_callback, (void *)this);
 		SDL_ResumeAudioDevice(SDL_GetAudioStreamDevice(m_sdl_stream));
 	} else {
 		fprintf(stderr, "SourceAudio: SDL_OpenAudioDeviceStream failed: %s\n", SDL_GetError());
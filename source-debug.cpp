@@ -11,7 +11,9 @@
 #include "window.hpp"
 
 
-static SDL_AudioStream *g_sdl_stream = nullptr;
+class SourceDebug;
+
+static SourceDebug *g_source = nullptr;
 
 class SourceDebug : public Source {
 public:
@@ -20,6 +22,7 @@ public:
 	~SourceDebug();
 
 	void open() override;
+	void put(float *data, size_t len);
 
 private:
 	SDL_AudioSpec m_src_spec;
@@ -38,20 +41,30 @@ SourceDebug::SourceDebug(Source::Info &info, SDL_AudioSpec &dst_spec, char *args
 
 SourceDebug::~SourceDebug()
 {
+	if(g_source == this) g_source = nullptr;
 }
 
 
 void SourceDebug::open()
 {
 	m_sdl_stream = SDL_CreateAudioStream(&m_src_spec, &m_dst_spec);
-	g_sdl_stream = m_sdl_stream;
+	g_source = this;
+}
+
+
+void SourceDebug::put(float *data, size_t len)
+{
+	if(m_sdl_stream) {
+		SDL_PutAudioStreamData(m_sdl_stream, (void *)data, len * sizeof(float));
+		notify();
+	}
 }
 
 
 void debug_source_put(float *data, size_t len)
 {
-	if (g_sdl_stream) {
-		SDL_PutAudioStreamData(g_sdl_stream, (void *)data, len * sizeof(float));
+	if (g_source) {
+		g_source->put(data, len);
 	}
 }
 
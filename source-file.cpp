@@ -7,6 +7,10 @@
 #include "source.hpp"
 #include "sourceregistry.hpp"
 #include "misc.hpp"
+#include "convert.hpp"
+
+// limit on data buffered in the SDL stream ahead of the capture thread
+static const int k_queued_max = 65536;
 
 class SourceFile : public Source {
 public:
@@ -14,13 +18,19 @@ public:
 	~SourceFile();
 
 	void poll() override;
+	int poll_fd() override;
 	void open() override;
+	size_t frames_avail() override;
+	size_t read(Sample *dst, size_t dst_stride, size_t frame_count) override;
 
 private:
 	SDL_AudioSpec m_src_spec{};
 	int m_fd{-1};
-	uint8_t m_buf[65536]{};
+	bool m_direct{false};
+	ConvertFn m_convert{};
+	alignas(16) uint8_t m_buf[65536]{};
 	size_t m_buf_bytes{0};
+	size_t m_buf_tail{0};
 };
 
 
@@ -46,6 +56,19 @@ void SourceFile::open()
 {
 	fcntl(m_fd, F_SETFL, O_NONBLOCK);
 
+	// no conversion needed: frames are copied from the read buffer straight
+	// into the ring buffer
+	m_direct = spec_matches(m_src_spec);
+	if(m_direct) return;
+
+	// only the sample format differs: convert from the read buffer without
+	// going through SDL
+	SDL_AudioSpec spec = m_src_spec;
+	spec.format = m_dst_spec.format;
+	m_convert = convert_fn(m_src_spec.format);
+	m_direct = m_convert && spec_matches(spec);
+	if(m_direct) return;
+
 	m_sdl_stream = SDL_CreateAudioStream(&m_src_spec, &m_dst_spec);
 	if(m_sdl_stream == nullptr) {
 		fprintf(stderr, "SourceFile SDL_CreateAudioStream failed: %s\n", SDL_GetError());
@@ -59,9 +82,20 @@ void SourceFile::poll()
 
 	size_t frame_size = m_src_spec.channels * SDL_AUDIO_BYTESIZE(m_src_spec.format);
 
-	ssize_t r = read(m_fd, m_buf + m_buf_bytes, sizeof(m_buf) - m_buf_bytes);
+	if(m_direct) {
+		if(m_buf_tail > 0) {
+			m_buf_bytes -= m_buf_tail;
+			memmove(m_buf, m_buf + m_buf_tail, m_buf_bytes);
+			m_buf_tail = 0;
+		}
+	} else {
+		if(SDL_GetAudioStreamQueued(m_sdl_stream) >= k_queued_max) return;
+	}
+
+	ssize_t r = ::read(m_fd, m_buf + m_buf_bytes, sizeof(m_buf) - m_buf_bytes);
 	if(r > 0) {
 		m_buf_bytes += r;
+		if(m_direct) return;
 		size_t frame_count = m_buf_bytes / frame_size;
 		bool ok = SDL_PutAudioStreamData(m_sdl_stream, m_buf, frame_count * frame_size);
 		
@@ -74,12 +108,54 @@ void SourceFile::poll()
 		m_fd = -1;
 	} else if(errno != EAGAIN && errno != EWOULDBLOCK) {
 		fprintf(stderr, "SourceFile read error: %s\n", strerror(errno));
+		report_error();
 		::close(m_fd);
 		m_fd = -1;
 	}
 }
 
 
+// Only wait for the fd when there is room for more data, otherwise the
+// capture thread would spin on a readable fd
+
+int SourceFile::poll_fd()
+{
+	if(m_fd == -1) return -1;
+	if(m_direct) {
+		if(m_buf_bytes == sizeof(m_buf)) return -1;
+	} else {
+		if(SDL_GetAudioStreamQueued(m_sdl_stream) >= k_queued_max) return -1;
+	}
+	return m_fd;
+}
+
+
+size_t SourceFile::frames_avail()
+{
+	if(!m_direct) return Source::frames_avail();
+	size_t src_frame_size = m_src_spec.channels * SDL_AUDIO_BYTESIZE(m_src_spec.format);
+	return (m_buf_bytes - m_buf_tail) / src_frame_size;
+}
+
+
+size_t SourceFile::read(Sample *dst, size_t dst_stride, size_t frame_count)
+{
+	if(!m_direct) return Source::read(dst, dst_stride, frame_count);
+	frame_count = std::min(frame_count, frames_avail());
+	if(m_convert) {
+		size_t src_frame_size = m_src_spec.channels * SDL_AUDIO_BYTESIZE(m_src_spec.format);
+		m_read_buf.resize(frame_count * channel_count());
+		m_convert(m_read_buf.data(), m_buf + m_buf_tail, frame_count * channel_count());
+		copy_frames(dst, dst_stride, m_read_buf.data(), frame_count, m_gain);
+		m_buf_tail += frame_count * src_frame_size;
+	} else {
+		copy_frames(dst, dst_stride, (Sample *)(m_buf + m_buf_tail), frame_count, m_gain);
+		m_buf_tail += frame_count * frame_size();
+	}
+	return frame_count;
+}
+
+
 REGISTER_STREAM_READER(SourceFile,
 	.name = "raw",
 	.description = "raw audio file reader",
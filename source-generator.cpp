@@ -13,21 +13,23 @@ public:
 	~SourceGenerator();
 
 	void open() override;
-	void poll() override;
 	void draw() override;
+	size_t frames_avail() override;
+	size_t read(Sample *dst, size_t dst_stride, size_t frame_count) override;
 
 private:
 
-	void gen_sine(std::vector<Sample> &buf);
-	void gen_saw(std::vector<Sample> &buf);
-	void gen_sweep(std::vector<Sample> &buf);
-	void gen_noise(std::vector<Sample> &buf);
+	void gen_sine(Sample *buf, size_t stride, size_t frame_count);
+	void gen_saw(Sample *buf, size_t stride, size_t frame_count);
+	void gen_sweep(Sample *buf, size_t stride, size_t frame_count);
+	void gen_noise(Sample *buf, size_t stride, size_t frame_count);
 
 	Samplerate m_srate{};
 	Time m_phase{};
+	Time m_t_start{};
+	size_t m_frames{};
 	double m_aux1{};
 	int m_type{};
-	std::vector<Sample> m_buf{};
 
 	struct {
 		bool enabled{false};
@@ -45,7 +47,6 @@ SourceGenerator::SourceGenerator(Source::Info &info, SDL_AudioSpec &dst_spec, ch
 	, m_srate(dst_spec.freq)
 	, m_type(atoi(args))
 {
-	m_buf.resize(1024);
 	m_filter.bq[0].configure(Biquad::Type::LP, 0.3);
 	m_filter.bq[1].configure(Biquad::Type::LP, 0.3);
 }
@@ -59,24 +60,55 @@ SourceGenerator::~SourceGenerator()
 
 void SourceGenerator::open()
 {
-	m_sdl_stream = SDL_CreateAudioStream(&m_dst_spec, &m_dst_spec);
 }
 
 
-void SourceGenerator::poll()
+// Pace the generator to real time; the backlog is dropped when capture was
+// paused for a while
+
+size_t SourceGenerator::frames_avail()
 {
-	if(m_type == 0) gen_sine(m_buf);
-	if(m_type == 1) gen_saw(m_buf);
-	if(m_type == 2) gen_sweep(m_buf);
-	if(m_type == 3) gen_noise(m_buf);
+	Time t_now = hirestime();
+	double frames = (t_now - m_t_start) * m_srate - m_frames;
+	if(frames > m_srate * 0.1) {
+		m_t_start = t_now;
+		m_frames = 0;
+		frames = 0;
+	}
+	return frames;
+}
 
-	if(m_filter.enabled) {
-		for(size_t i=0; i<m_buf.size(); i++) {
-			m_buf[i] = m_filter.bq[1].run(m_filter.bq[0].run(m_buf[i]));
+
+// The generator renders straight into its channel slot of the ring buffer
+
+size_t SourceGenerator::read(Sample *dst, size_t dst_stride, size_t frame_count)
+{
+	if(m_type == 0) gen_sine(dst, dst_stride, frame_count);
+	if(m_type == 1) gen_saw(dst, dst_stride, frame_count);
+	if(m_type == 2) gen_sweep(dst, dst_stride, frame_count);
+	if(m_type == 3) gen_noise(dst, dst_stride, frame_count);
+	m_frames += frame_count;
+
+	// the signal goes to the first channel, other channels are silent, as
+	// is everything for unknown types
+	size_t ch_silent = (m_type >= 0 && m_type <= 3) ? 1 : 0;
+	for(size_t i=0; i<frame_count; i++) {
+		for(size_t ch=ch_silent; ch<channel_count(); ch++) {
+			dst[i * dst_stride + ch] = 0.0f;
 		}
 	}
 
-	SDL_PutAudioStreamData(m_sdl_stream, m_buf.data(), m_buf.size() * sizeof(Sample));
+	if(m_filter.enabled || m_gain != 1.0) {
+		Sample *p = dst;
+		for(size_t i=0; i<frame_count; i++) {
+			double v = *p;
+			if(m_filter.enabled) v = m_filter.bq[1].run(m_filter.bq[0].run(v));
+			*p = std::clamp(v * m_gain, (double)-k_sample_max, (double)k_sample_max);
+			p += dst_stride;
+		}
+	}
+
+	return frame_count;
 }
 
 
@@ -104,45 +136,35 @@ void SourceGenerator::draw()
 		if(update) {
 			m_filter.bq[0].configure(Biquad::Type::LP, 2.0 * m_filter.freq / m_srate, m_filter.Q);
 			m_filter.bq[1].configure(Biquad::Type::LP, 2.0 * m_filter.freq / m_srate, m_filter.Q);
-			SDL_ClearAudioStream(m_sdl_stream);
 		}
 	}
 }
 
 
-static Sample float_to_s16(double v)
+void SourceGenerator::gen_sine(Sample *buf, size_t stride, size_t frame_count)
 {
-	double dither = (double)rand() / RAND_MAX - 0.5;
-	return (int16_t)floor(v * 32767 + dither);
-}
-
-
-void SourceGenerator::gen_sine(std::vector<Sample> &buf)
-{
-	for(size_t i=0; i<buf.size(); i++) {
-		buf[i] = float_to_s16(sin(m_phase * 2 * M_PI));
+	for(size_t i=0; i<frame_count; i++) {
+		buf[i * stride] = sin(m_phase * 2 * M_PI);
 		m_phase += 440.0 / m_srate;
 		m_phase = fmod(m_phase, 1.0);
 	}
 }
 
 
-void SourceGenerator::gen_saw(std::vector<Sample> &buf)
+void SourceGenerator::gen_saw(Sample *buf, size_t stride, size_t frame_count)
 {
-	Sample v = 0;
-
-	if(m_type == 0) {
-		v = float_to_s16(sin(m_phase * 2 * M_PI));
+	for(size_t i=0; i<frame_count; i++) {
+		buf[i * stride] = m_phase * 2.0 - 1.0;
 		m_phase += 440.0 / m_srate;
 		m_phase = fmod(m_phase, 1.0);
 	}
 }
 
 
-void SourceGenerator::gen_sweep(std::vector<Sample> &buf)
+void SourceGenerator::gen_sweep(Sample *buf, size_t stride, size_t frame_count)
 {
-	for(size_t i=0; i<buf.size(); i++) {
-		buf[i] = float_to_s16(sin(m_phase * 2 * M_PI));
+	for(size_t i=0; i<frame_count; i++) {
+		buf[i * stride] = sin(m_phase * 2 * M_PI);
 		m_aux1 += 0.1;
 		m_phase += m_aux1 / m_srate;
 		m_phase = fmod(m_phase, 1.0);
@@ -151,11 +173,11 @@ void SourceGenerator::gen_sweep(std::vector<Sample> &buf)
 }
 
 
-void SourceGenerator::gen_noise(std::vector<Sample> &buf)
+void SourceGenerator::gen_noise(Sample *buf, size_t stride, size_t frame_count)
 {
-	for(size_t i=0; i<buf.size(); i++) {
+	for(size_t i=0; i<frame_count; i++) {
 		float v = (double)rand() / RAND_MAX * 2.0 - 1.0;
-		buf[i] = float_to_s16(v * 0.01);
+		buf[i * stride] = v * 0.01;
 	}
 }
 
@@ -1,20 +1,29 @@
 
 #include <SDL3/SDL_audio.h>
 #include <jack/jack.h>
+#include <jack/ringbuffer.h>
+#include <imgui.h>
 
 #include "source.hpp"
 #include "sourceregistry.hpp"
 
+// per port ring buffer between the jack process thread and the capture thread
+static const size_t k_ring_frames = 65536;
+
 class SourceJack : public Source {
 public:
 	SourceJack(Source::Info &info, SDL_AudioSpec &dst_spec, char *args);
 	~SourceJack();
 
 	void open() override;
+	void poll() override;
 	void pause() override;
 	void resume() override;
+	bool realtime() override { return true; }
+	void draw() override;
 
 	int process_callback(jack_nframes_t nframes);
+	int xrun_callback();
 
 private:
 	SDL_AudioSpec m_src_spec{};
@@ -23,11 +32,14 @@ private:
 	struct Port {
 		char name[32];
 		jack_port_t *jack_port;
+		jack_ringbuffer_t *ring;
 	};
 
 	size_t m_jack_buffer_size{};
 	std::vector<Port> m_ports;
 	std::vector<float> m_buffer;
+	std::atomic<size_t> m_xruns{};
+	std::atomic<size_t> m_overflows{};
 };
 
 
@@ -44,6 +56,7 @@ SourceJack::~SourceJack()
 	jack_deactivate(m_jack_client);
 	for(auto &port : m_ports) {
 		jack_port_unregister(m_jack_client, port.jack_port);
+		jack_ringbuffer_free(port.ring);
 	}
 	jack_client_close(m_jack_client);
 }
@@ -56,19 +69,74 @@ static int process_callback_(jack_nframes_t nframes, void *arg)
 }
 
 
+static int xrun_callback_(void *arg)
+{
+	SourceJack *reader = static_cast<SourceJack *>(arg);
+	return reader->xrun_callback();
+}
+
+
+// Runs in the jack realtime thread: only copy the port buffers into the
+// lock-free rings, interleaving and conversion is done by the capture thread.
+// The period is dropped for all ports if any ring is full to keep the ports
+// aligned.
+
 int SourceJack::process_callback(jack_nframes_t nframes)
 {
+	size_t bytes = nframes * sizeof(float);
+	for(auto &port : m_ports) {
+		if(jack_ringbuffer_write_space(port.ring) < bytes) {
+			m_overflows.fetch_add(1, std::memory_order_relaxed);
+			report_lost(nframes);
+			return 0;
+		}
+	}
+	for(auto &port : m_ports) {
+		float *p = (float *)jack_port_get_buffer(port.jack_port, nframes);
+		jack_ringbuffer_write(port.ring, (const char *)p, bytes);
+	}
+	notify();
+	return 0;
+}
+
+
+int SourceJack::xrun_callback()
+{
+	m_xruns.fetch_add(1, std::memory_order_relaxed);
+	return 0;
+}
+
+
+// Interleave the frames queued by the process thread and pass them to the
+// SDL stream for conversion and drift correction
+
+void SourceJack::poll()
+{
+	if(m_sdl_stream == nullptr) return;
+
 	size_t stride = m_ports.size();
-	for(size_t i=0; i<m_ports.size(); i++) {
-		auto &port = m_ports[i];
+	size_t frame_count = m_buffer.size() / stride;
+	for(auto &port : m_ports) {
+		frame_count = std::min(frame_count, jack_ringbuffer_read_space(port.ring) / sizeof(float));
+	}
+	if(frame_count == 0) return;
+
+	for(size_t i=0; i<stride; i++) {
+		jack_ringbuffer_data_t vec[2];
+		jack_ringbuffer_get_read_vector(m_ports[i].ring, vec);
 		float *buf = m_buffer.data() + i;
-		float *p = (float *)jack_port_get_buffer(port.jack_port, nframes);
-		for(size_t j=0; j<nframes; j++) {
-			buf[j * stride] = p[j];
+		size_t n = 0;
+		for(auto &v : vec) {
+			float *p = (float *)v.buf;
+			size_t len = std::min(v.len / sizeof(float), frame_count - n);
+			for(size_t j=0; j<len; j++) {
+				buf[(n + j) * stride] = p[j];
+			}
+			n += len;
 		}
+		jack_ringbuffer_read_advance(m_ports[i].ring, frame_count * sizeof(float));
 	}
-	SDL_PutAudioStreamData(m_sdl_stream, m_buffer.data(), nframes * stride * sizeof(float));
-	return 0;
+	SDL_PutAudioStreamData(m_sdl_stream, m_buffer.data(), frame_count * stride * sizeof(float));
 }
 
 
@@ -89,6 +157,8 @@ void SourceJack::open()
 			fprintf(stderr, "SourceJack jack_port_register failed for port %d\n", i);
 			return;
 		}
+		port.ring = jack_ringbuffer_create(k_ring_frames * sizeof(float));
+		jack_ringbuffer_mlock(port.ring);
 		m_ports.push_back(port);
 	}
 	
@@ -97,7 +167,7 @@ void SourceJack::open()
 	m_src_spec.channels = m_dst_spec.channels;
 
 	m_jack_buffer_size = jack_get_buffer_size(m_jack_client);
-	m_buffer.resize(m_jack_buffer_size * m_src_spec.channels);
+	m_buffer.resize(k_ring_frames * m_src_spec.channels);
 
 	m_sdl_stream = SDL_CreateAudioStream(&m_src_spec, &m_dst_spec);
 	if(m_sdl_stream == nullptr) {
@@ -106,6 +176,7 @@ void SourceJack::open()
 	}
 
 	jack_set_process_callback(m_jack_client, process_callback_, this);
+	jack_set_xrun_callback(m_jack_client, xrun_callback_, this);
 }
 
 
@@ -121,6 +192,14 @@ void SourceJack::resume()
 }
 
 
+void SourceJack::draw()
+{
+	ImGui::Text("xruns: %zu, overflows: %zu",
+			m_xruns.load(std::memory_order_relaxed),
+			m_overflows.load(std::memory_order_relaxed));
+}
+
+
 REGISTER_STREAM_READER(SourceJack,
 	.name = "jack",
 	.description = "Jack audio source",
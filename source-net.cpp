@@ -0,0 +1,429 @@
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <type_traits>
+
+#include <imgui.h>
+
+#include "source.hpp"
+#include "sourceregistry.hpp"
+#include "misc.hpp"
+
+// packets received per recvmmsg() call
+static const size_t k_batch = 64;
+// reorder window, must be a power of two
+static const size_t k_slots = 512;
+// largest datagram, allows for jumbo frames
+static const size_t k_packet_max = 9000;
+// a missing packet is declared lost once this many later packets arrived
+static const size_t k_reorder_max = 16;
+// most channels accepted in one stream
+static const int k_channels_max = 64;
+
+static_assert(k_channels_max * 3 <= k_packet_max - 12, "a packet must fit at least one frame");
+
+class SourceNet : public Source {
+public:
+	SourceNet(Source::Info &info, SDL_AudioSpec &dst_spec, char *args);
+	~SourceNet();
+
+	void open() override;
+	void poll() override;
+	int poll_fd() override;
+	size_t frames_avail() override;
+	size_t read(Sample *dst, size_t dst_stride, size_t frame_count) override;
+	bool realtime() override { return true; }
+	void resume() override;
+	void draw() override;
+
+private:
+
+	struct Slot {
+		uint8_t *buf;
+		size_t seq;
+		size_t payload_offset;
+		size_t frame_count;
+		bool valid;
+	};
+
+	struct Stats {
+		size_t received;
+		size_t lost;
+		size_t reordered;
+		size_t late;
+		size_t overflows;
+		double jitter;
+	};
+
+	void receive(uint8_t *buf, size_t len, struct timespec *ts);
+	void decode(Sample *dst, size_t dst_stride, const uint8_t *src, size_t frame_count);
+	bool slot_ready(size_t seq);
+
+	char m_addr[64]{};
+	int m_port{5004};
+	int m_bytes_per_sample{3};
+	int m_srate{};
+	int m_fd{-1};
+
+	std::vector<uint8_t> m_pool;
+	std::vector<Slot> m_slots;
+	uint8_t *m_batch[k_batch]{};
+
+	bool m_synced{false};
+	size_t m_seq_next{};            // next packet to be read
+	size_t m_seq_high{};            // highest packet received
+	size_t m_frame_offset{};        // frames already read from packet m_seq_next
+	size_t m_packet_frames{};       // frames per packet, used to pad lost packets
+
+	uint32_t m_ts_prev{};
+	double m_t_arrival_prev{};
+	Stats m_stats{};
+};
+
+
+// args: ADDR[:PORT][:CHANNELS][:l16|l24][:SRATE]. A sender rate other than
+// the stream rate puts the source in a channel group of its own.
+
+SourceNet::SourceNet(Source::Info &info, SDL_AudioSpec &dst_spec, char *args)
+	: Source(info, dst_spec, args)
+{
+	m_dst_spec.channels = 2;
+	m_srate = dst_spec.freq;
+
+	char *s = strtok(args, ":");
+	if(s) snprintf(m_addr, sizeof(m_addr), "%s", s);
+	int n = 0;
+	while((s = strtok(nullptr, ":"))) {
+		if(strcmp(s, "l16") == 0) {
+			m_bytes_per_sample = 2;
+		} else if(strcmp(s, "l24") == 0) {
+			m_bytes_per_sample = 3;
+		} else {
+			char *end;
+			long val = strtol(s, &end, 10);
+			if(end == s || *end != '\0' || val > 0x7fffffff) val = -1;
+			if(n == 0) m_port = val;
+			if(n == 1) m_dst_spec.channels = val;
+			if(n == 2) m_srate = val;
+			n++;
+		}
+	}
+
+	if(m_port < 1 || m_port > 65535) {
+		fprintf(stderr, "SourceNet: invalid port in '%s'\n", m_args);
+		exit(1);
+	}
+	if(m_dst_spec.channels < 1 || m_dst_spec.channels > k_channels_max) {
+		fprintf(stderr, "SourceNet: invalid channel count in '%s', must be 1..%d\n", m_args, k_channels_max);
+		exit(1);
+	}
+	if(m_srate <= 0) {
+		fprintf(stderr, "SourceNet: invalid sample rate in '%s'\n", m_args);
+		exit(1);
+	}
+	m_dst_spec.freq = m_srate;
+
+	m_pool.resize((k_slots + k_batch) * k_packet_max);
+	m_slots.resize(k_slots);
+	for(size_t i=0; i<k_slots; i++) {
+		m_slots[i].buf = m_pool.data() + i * k_packet_max;
+	}
+	for(size_t i=0; i<k_batch; i++) {
+		m_batch[i] = m_pool.data() + (k_slots + i) * k_packet_max;
+	}
+}
+
+
+SourceNet::~SourceNet()
+{
+	if(m_fd != -1) {
+		::close(m_fd);
+	}
+}
+
+
+void SourceNet::open()
+{
+	m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(m_fd == -1) {
+		fprintf(stderr, "SourceNet: socket failed: %s\n", strerror(errno));
+		return;
+	}
+
+	int one = 1;
+	int rcvbuf = 8 * 1024 * 1024;
+	setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+	setsockopt(m_fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+
+	struct in_addr addr{};
+	if(inet_pton(AF_INET, m_addr, &addr) != 1) {
+		fprintf(stderr, "SourceNet: invalid address '%s'\n", m_addr);
+		::close(m_fd);
+		m_fd = -1;
+		return;
+	}
+
+	struct sockaddr_in sa{};
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(m_port);
+	sa.sin_addr.s_addr = IN_MULTICAST(ntohl(addr.s_addr)) ? addr.s_addr : INADDR_ANY;
+	if(bind(m_fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+		fprintf(stderr, "SourceNet: bind to port %d failed: %s\n", m_port, strerror(errno));
+		::close(m_fd);
+		m_fd = -1;
+		return;
+	}
+
+	if(IN_MULTICAST(ntohl(addr.s_addr))) {
+		struct ip_mreq mreq{};
+		mreq.imr_multiaddr = addr;
+		mreq.imr_interface.s_addr = INADDR_ANY;
+		if(setsockopt(m_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1) {
+			fprintf(stderr, "SourceNet: joining %s failed: %s\n", m_addr, strerror(errno));
+		}
+	}
+}
+
+
+int SourceNet::poll_fd()
+{
+	return m_fd;
+}
+
+
+void SourceNet::resume()
+{
+	for(auto &slot : m_slots) {
+		slot.valid = false;
+	}
+	m_synced = false;
+	m_frame_offset = 0;
+}
+
+
+// Drain the socket in batches. Packets are parsed and swapped into their
+// sequence number slot without copying the payload.
+
+void SourceNet::poll()
+{
+	if(m_fd == -1) return;
+
+	struct mmsghdr msgs[k_batch];
+	struct iovec iovs[k_batch];
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(struct timespec))];
+	} ctrl[k_batch];
+
+	for(;;) {
+		for(size_t i=0; i<k_batch; i++) {
+			iovs[i] = { m_batch[i], k_packet_max };
+			msgs[i].msg_hdr = {};
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = ctrl[i].buf;
+			msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i].buf);
+		}
+
+		int n = recvmmsg(m_fd, msgs, k_batch, MSG_DONTWAIT, nullptr);
+		if(n <= 0) {
+			if(n == -1 && errno != EAGAIN && errno != EWOULDBLOCK) {
+				fprintf(stderr, "SourceNet: recvmmsg failed: %s\n", strerror(errno));
+			}
+			break;
+		}
+
+		for(int i=0; i<n; i++) {
+			struct timespec *ts = nullptr;
+			for(auto c = CMSG_FIRSTHDR(&msgs[i].msg_hdr); c; c = CMSG_NXTHDR(&msgs[i].msg_hdr, c)) {
+				if(c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_TIMESTAMPNS) {
+					ts = (struct timespec *)CMSG_DATA(c);
+				}
+			}
+			receive(m_batch[i], msgs[i].msg_len, ts);
+		}
+
+		m_t_put.store(hirestime(), std::memory_order_relaxed);
+		if(n < (int)k_batch) break;
+	}
+}
+
+
+// Handle one RTP packet held in m_batch buffer buf
+
+void SourceNet::receive(uint8_t *buf, size_t len, struct timespec *ts)
+{
+	if(len < 12 || (buf[0] >> 6) != 2) return;
+
+	size_t cc = buf[0] & 0x0f;
+	size_t offset = 12 + cc * 4;
+	if(buf[0] & 0x10) {
+		if(len < offset + 4) return;
+		offset += 4 + ((buf[offset + 2] << 8) | buf[offset + 3]) * 4;
+	}
+	if(buf[0] & 0x20) {
+		// the last byte counts the padding bytes, including itself
+		size_t pad = buf[len - 1];
+		if(pad < 1 || len <= offset || pad > len - offset) return;
+		len -= pad;
+	}
+	if(len <= offset) return;
+
+	uint16_t seq16 = (buf[2] << 8) | buf[3];
+	uint32_t ts_rtp = (buf[4] << 24) | (buf[5] << 16) | (buf[6] << 8) | buf[7];
+	size_t frame_size = channel_count() * m_bytes_per_sample;
+	size_t frame_count = (len - offset) / frame_size;
+	if(frame_count == 0) return;
+
+	// extend the 16 bit sequence number relative to the highest seen
+	if(!m_synced) {
+		m_seq_next = m_seq_high = seq16 + 0x10000;
+		m_frame_offset = 0;
+		m_synced = true;
+	}
+	size_t seq = m_seq_high + (int16_t)(seq16 - (uint16_t)m_seq_high);
+
+	if(seq < m_seq_next) {
+		m_stats.late ++;
+		return;
+	}
+	if(seq >= m_seq_next + k_slots) {
+		// reader fell too far behind or the sender restarted
+		m_stats.overflows ++;
+		report_error();
+		resume();
+		m_seq_next = m_seq_high = seq;
+		m_synced = true;
+	}
+	if(seq < m_seq_high) {
+		m_stats.reordered ++;
+	} else {
+		m_seq_high = seq;
+	}
+
+	// interarrival jitter as in RFC 3550, in seconds
+	double t_arrival = ts ? ts->tv_sec + ts->tv_nsec * 1e-9 : hirestime();
+	if(m_stats.received > 0) {
+		double d = (t_arrival - m_t_arrival_prev) - (int32_t)(ts_rtp - m_ts_prev) / (double)m_srate;
+		m_stats.jitter += (fabs(d) - m_stats.jitter) / 16.0;
+	}
+	m_t_arrival_prev = t_arrival;
+	m_ts_prev = ts_rtp;
+	m_stats.received ++;
+
+	Slot &slot = m_slots[seq & (k_slots - 1)];
+	for(auto &b : m_batch) {
+		if(b == buf) {
+			std::swap(b, slot.buf);
+			break;
+		}
+	}
+	slot.seq = seq;
+	slot.payload_offset = offset;
+	slot.frame_count = frame_count;
+	slot.valid = true;
+	m_packet_frames = frame_count;
+}
+
+
+// True if the packet with sequence number seq can be read, either because it
+// arrived or because it is given up on
+
+bool SourceNet::slot_ready(size_t seq)
+{
+	Slot &slot = m_slots[seq & (k_slots - 1)];
+	if(slot.valid && slot.seq == seq) return true;
+	return m_seq_high >= seq + k_reorder_max;
+}
+
+
+size_t SourceNet::frames_avail()
+{
+	if(!m_synced) return 0;
+	size_t frames = 0;
+	for(size_t seq=m_seq_next; seq<=m_seq_high && slot_ready(seq); seq++) {
+		Slot &slot = m_slots[seq & (k_slots - 1)];
+		frames += (slot.valid && slot.seq == seq) ? slot.frame_count : m_packet_frames;
+	}
+	return frames - m_frame_offset;
+}
+
+
+// Decode big endian L16/L24 samples straight into the stream frames
+
+void SourceNet::decode(Sample *dst, size_t dst_stride, const uint8_t *src, size_t frame_count)
+{
+	size_t channels = channel_count();
+	for(size_t i=0; i<frame_count; i++) {
+		for(size_t ch=0; ch<channels; ch++) {
+			int32_t v = (src[0] << 24) | (src[1] << 16);
+			if(m_bytes_per_sample == 3) v |= src[2] << 8;
+			src += m_bytes_per_sample;
+			dst[ch] = v * (1.0 / 2147483648.0) * m_gain;
+		}
+		dst += dst_stride;
+	}
+}
+
+
+size_t SourceNet::read(Sample *dst, size_t dst_stride, size_t frame_count)
+{
+	size_t frame_size = channel_count() * m_bytes_per_sample;
+	size_t frames_read = 0;
+
+	while(frames_read < frame_count && m_seq_next <= m_seq_high && slot_ready(m_seq_next)) {
+		Slot &slot = m_slots[m_seq_next & (k_slots - 1)];
+		bool valid = slot.valid && slot.seq == m_seq_next;
+		size_t packet_frames = valid ? slot.frame_count : m_packet_frames;
+		size_t n = std::min(packet_frames - m_frame_offset, frame_count - frames_read);
+
+		if(valid) {
+			decode(dst, dst_stride, slot.buf + slot.payload_offset + m_frame_offset * frame_size, n);
+		} else {
+			for(size_t i=0; i<n; i++) {
+				memset(dst + i * dst_stride, 0, channel_count() * sizeof(Sample));
+			}
+		}
+
+		dst += n * dst_stride;
+		frames_read += n;
+		m_frame_offset += n;
+
+		if(m_frame_offset == packet_frames) {
+			if(!valid) {
+				m_stats.lost ++;
+				report_lost(packet_frames);
+			}
+			slot.valid = false;
+			m_seq_next ++;
+			m_frame_offset = 0;
+		}
+	}
+
+	return frames_read;
+}
+
+
+void SourceNet::draw()
+{
+	ImGui::Text("rx: %zu, lost: %zu, reordered: %zu, late: %zu, overflows: %zu, jitter: %.3f ms",
+			m_stats.received, m_stats.lost, m_stats.reordered,
+			m_stats.late, m_stats.overflows, m_stats.jitter * 1000.0);
+}
+
+
+REGISTER_STREAM_READER(SourceNet,
+	.name = "net",
+	.description = "RTP L16/L24 network source",
+);
+
@@ -1 +1,81 @@
 
+#include <string.h>
+#include <algorithm>
+
+#include "source.hpp"
+#include "interleave.hpp"
+
+
+// Default ingest path: the source pushes data into its SDL audio stream,
+// which takes care of format and sample rate conversion. Sources that
+// produce data in the stream format override frames_avail() and read()
+// and write directly into the ring buffer instead.
+
+size_t Source::frames_avail()
+{
+	if(m_sdl_stream == nullptr) return 0;
+	int bytes_avail = SDL_GetAudioStreamAvailable(m_sdl_stream);
+	if(bytes_avail < 0) {
+		printf("SDL_GetAudioStreamAvailable(): %s\n", SDL_GetError());
+		exit(1);
+	}
+	return (size_t)bytes_avail / frame_size();
+}
+
+
+size_t Source::read(Sample *dst, size_t dst_stride, size_t frame_count)
+{
+	m_read_buf.resize(frame_count * channel_count());
+	int bytes_want = frame_count * frame_size();
+	int bytes_read = SDL_GetAudioStreamData(m_sdl_stream, m_read_buf.data(), bytes_want);
+	if(bytes_read < 0) report_error();
+	size_t frames_read = bytes_read > 0 ? bytes_read / frame_size() : 0;
+	copy_frames(dst, dst_stride, m_read_buf.data(), frames_read);
+	return frames_read;
+}
+
+
+// Adjust the source sample rate by the given ratio to compensate for clock
+// drift. Only possible for sources going through an SDL audio stream.
+
+bool Source::set_ratio(double ratio)
+{
+	if(m_sdl_stream == nullptr) return false;
+	return SDL_SetAudioStreamFrequencyRatio(m_sdl_stream, ratio);
+}
+
+
+// True if data in the given spec can be written to the stream as-is
+
+bool Source::spec_matches(SDL_AudioSpec &src_spec)
+{
+	return src_spec.format == m_dst_spec.format &&
+	       src_spec.freq == m_dst_spec.freq &&
+	       src_spec.channels == m_dst_spec.channels;
+}
+
+
+// Copy interleaved source frames into this source's channel slots of the
+// stream frames at dst
+
+void Source::copy_frames(Sample *dst, size_t dst_stride, const Sample *src, size_t frame_count, Gain gain)
+{
+	size_t channels = channel_count();
+	if(gain == 1.0) {
+		InterleaveFn fn = interleave_fn(channels);
+		if(fn) {
+			fn(dst, dst_stride, src, frame_count);
+		} else {
+			interleave_n(dst, dst_stride, src, channels, frame_count);
+		}
+	} else {
+		for(size_t i=0; i<frame_count; i++) {
+			for(size_t ch=0; ch<channels; ch++) {
+				double v = src[ch] * gain;
+				dst[ch] = std::clamp(v, (double)-k_sample_max, (double)k_sample_max);
+			}
+			src += channels;
+			dst += dst_stride;
+		}
+	}
+}
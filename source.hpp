@@ -4,11 +4,13 @@
 #include <stdint.h>
 #include <assert.h>
 #include <vector>
+#include <atomic>
 
 #include "types.hpp"
 #include "misc.hpp"
 #include "stream.hpp"
 #include "vumeter.hpp"
+#include "notifier.hpp"
 
 class Source {
 public:
@@ -19,6 +21,17 @@ public:
 		Source *(*fn_new)(SDL_AudioSpec &dst_spec, char *args);
 	};
 
+	// ingest state, maintained by the capture thread
+	struct Ingest {
+		Time offset{};          // smoothed age of queued data relative to the first realtime source
+		double ratio{1.0};      // drift correction resample ratio
+		double integ{};         // drift controller integrator
+		size_t debt{};          // frames padded with silence, dropped when they arrive late
+		size_t underruns{};
+		size_t frames_padded{};
+		size_t frames_dropped{};
+	};
+
 	Source(Source::Info &info, SDL_AudioSpec &dst_spec, const char *args)
 		: m_info(info)
 		, m_frame_size(dst_spec.channels * sizeof(Sample))
@@ -39,9 +52,25 @@ public:
 	const Info &info() { return m_info; }
 	const char *args() { return m_args; }
 	SDL_AudioSpec &src_spec() { return m_dst_spec; }
-
-	Gain gain() { return SDL_GetAudioStreamGain(m_sdl_stream); };
-	void set_gain(Gain gain) { SDL_SetAudioStreamGain(m_sdl_stream, gain); }
+	void set_notifier(Notifier *notifier) { m_notifier = notifier; }
+	void notify() {
+		m_t_put.store(hirestime(), std::memory_order_relaxed);
+		if(m_notifier) m_notifier->notify();
+	}
+	Time t_put() { return m_t_put.load(std::memory_order_relaxed); }
+
+	// losses detected by the source itself, may be called from any thread
+	void report_lost(size_t frame_count) { m_frames_lost.fetch_add(frame_count, std::memory_order_relaxed); }
+	void report_error() { m_errors.fetch_add(1, std::memory_order_relaxed); }
+	size_t take_lost() { return m_frames_lost.exchange(0, std::memory_order_relaxed); }
+	size_t take_errors() { return m_errors.exchange(0, std::memory_order_relaxed); }
+	Ingest &ingest() { return m_ingest; }
+
+	Gain gain() { return m_gain; };
+	void set_gain(Gain gain) {
+		m_gain = gain;
+		if(m_sdl_stream) SDL_SetAudioStreamGain(m_sdl_stream, gain);
+	}
 
 	void dump(FILE *f) {
 		fprintf(f, "%s (%s) %d/%s/%d\n",
@@ -54,16 +83,31 @@ public:
 
 	virtual void open(void) = 0;
 	virtual void poll(void) {};
+	virtual int poll_fd(void) { return -1; };
+	virtual size_t frames_avail(void);
+	virtual size_t read(Sample *dst, size_t dst_stride, size_t frame_count);
+	virtual bool realtime(void) { return false; };
+	virtual bool set_ratio(double ratio);
 	virtual void pause(void) {};
 	virtual void resume(void) {};
 	virtual void draw(void) {};
 
 protected:
+	bool spec_matches(SDL_AudioSpec &src_spec);
+	void copy_frames(Sample *dst, size_t dst_stride, const Sample *src, size_t frame_count, Gain gain = 1.0);
+
 	Source::Info m_info;
 	size_t m_frame_size{};
 	SDL_AudioSpec m_dst_spec{};
 	SDL_AudioStream *m_sdl_stream{};
 	const char *m_args{};
+	Gain m_gain{1.0};
+	Notifier *m_notifier{};
+	std::atomic<Time> m_t_put{0.0};
+	std::atomic<size_t> m_frames_lost{};
+	std::atomic<size_t> m_errors{};
+	Ingest m_ingest{};
+	std::vector<Sample> m_read_buf{};
 
 	struct SourceChannel {
 		VuMeter vu_meter;
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <math.h>
 #include <algorithm>
@@ -11,11 +12,15 @@
 
 #include "stream.hpp"
 #include "source.hpp"
+#include "misc.hpp"
+#include "wavfile.hpp"
+#include "convert.hpp"
 
 Stream::Stream()
 	: player(Player(*this))
 	, capture(*this)
-	, m_wavecache(Wavecache(256))
+	, pipeline(*this)
+	, recorder(*this)
 {
 }
 
@@ -47,32 +52,304 @@ void Stream::set_sample_rate(Samplerate srate)
 }
 
 
-void Stream::allocate(size_t depth)
+// Create a group for the next channel_count stream channels
+
+Stream::Group &Stream::add_group(Samplerate srate, size_t channel_count)
+{
+	auto group = std::make_unique<Group>();
+	group->srate = srate;
+	group->channel_first = m_channel_count;
+	group->channel_count = channel_count;
+	group->frame_size = channel_count * sample_type_size(m_sample_type);
+	group->rb_frame_size = group->frame_size;
+	m_channel_count += channel_count;
+	m_channel_group.resize(m_channel_count, m_groups.size());
+	m_groups.push_back(std::move(group));
+	return *m_groups.back();
+}
+
+
+// Allocate one group per sample rate, following the capture source order.
+// depth is given in frames at the stream sample rate; each group holds the
+// same time span, so low rate groups take proportionally less memory.
+// rb_flags select huge page backing, prefaulting and locking of the ring
+// buffer and wavecache memory.
+
+void Stream::allocate(size_t depth, int rb_flags)
+{
+	m_groups.clear();
+	m_channel_group.clear();
+	m_channel_count = 0;
+
+	auto &sources = capture.sources();
+	for(size_t i=0; i<sources.size(); ) {
+		Samplerate srate = sources[i]->src_spec().freq;
+		size_t channel_count = 0;
+		for(; i<sources.size() && sources[i]->src_spec().freq == srate; i++) {
+			channel_count += sources[i]->channel_count();
+		}
+		Group &group = add_group(srate, channel_count);
+		group.depth = depth * srate / m_srate;
+		group.rb.set_size(group.depth * group.frame_size, rb_flags);
+		group.wavecache.allocate(group.depth, group.channel_count, rb_flags);
+	}
+
+	pipeline.add("wavecache", &m_display);
+	player.set_channel_count(m_channel_count);
+}
+
+
+void Stream::Display::process(size_t group, const uint8_t *data, size_t frame, size_t frame_count)
 {
-	m_channel_count = capture.channel_count();
+	m_stream.group(group).wavecache.feed(data, m_stream.sample_type(), frame_count);
+	if(group == 0) {
+		m_frame_event = frame + frame_count;
+		m_frames_event += frame_count;
+	}
+}
+
+
+void Stream::Display::skip(size_t group, size_t frame, size_t frame_count)
+{
+	m_stream.group(group).wavecache.skip(frame_count);
+}
+
+
+// Signal the main thread new audio is available, positions are given in
+// frames at the stream rate since the capture start
+
+void Stream::Display::idle()
+{
+	uint64_t t_now = SDL_GetTicks();
+	if(m_frames_event > 0 && t_now > m_t_event) {
+		m_t_event = t_now + 10;
+		double scale = m_stream.sample_rate() / m_stream.group(0).srate;
+		SDL_Event event;
+		SDL_zero(event);
+		event.type = SDL_EVENT_USER;
+		event.user.code = k_user_event_audio_capture;
+		event.user.data1 = (void *)(size_t)(m_frame_event * scale);
+		event.user.data2 = (void *)(size_t)(m_frames_event * scale);
+		SDL_PushEvent(&event);
+		m_frames_event = 0;
+	}
+}
+
+
+// Serve the stream directly from a memory mapping of a WAV/RF64 or raw file
+// instead of capturing it into the ring buffer. The page cache holds the only
+// copy of the data; the wavecache is built in the background. The stream
+// takes the sample type of s16 and f32 files, files in other sample formats
+// are converted to f32 whenever they are read.
+
+bool Stream::open_file(const char *path, char *spec_str)
+{
+	int fd = ::open(path, O_RDONLY);
+	if(fd == -1) {
+		fprintf(stderr, "error: %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	SDL_AudioSpec spec;
+	size_t data_offset = 0;
+	size_t data_len = 0;
+
+	WavStatus status = wavfile_parse(fd, spec, &data_offset, &data_len);
+	if(status == WavStatus::Unsupported) {
+		fprintf(stderr, "error: %s: unsupported or damaged wave file\n", path);
+		::close(fd);
+		return false;
+	}
+	if(status == WavStatus::NotWave) {
+		char buf[64] = "";
+		if(spec_str) snprintf(buf, sizeof(buf), "%s", spec_str);
+		spec = sdl_audiospec_from_str(buf);
+		size_t frame_size = spec.channels * SDL_AUDIO_BYTESIZE(spec.format);
+		data_len = lseek(fd, 0, SEEK_END);
+		data_len -= data_len % frame_size;
+	}
+
+	size_t file_frame_size = spec.channels * SDL_AUDIO_BYTESIZE(spec.format);
+
+	bool direct = spec.format == SDL_AUDIO_S16 || spec.format == SDL_AUDIO_F32;
+	ConvertFn convert = nullptr;
+	if(direct) {
+		m_sample_type = spec.format == SDL_AUDIO_S16 ? SampleType::S16 : SampleType::F32;
+	} else {
+		convert = convert_fn(spec.format);
+		if(convert == nullptr) {
+			fprintf(stderr, "error: %s: sample format %s not supported\n", 
+					path, sdl_audioformat_to_str(spec.format));
+			::close(fd);
+			return false;
+		}
+		m_sample_type = SampleTraits<Sample>::type;
+	}
 
-	m_frame_size = m_channel_count * sizeof(Sample);
-	m_depth = depth;
-	m_rb.set_size(m_depth * m_frame_size);
-	m_wavecache.allocate(depth, m_channel_count);
+	set_sample_rate(spec.freq);
+	Group &group = add_group(spec.freq, spec.channels);
+	group.depth = data_len / file_frame_size;
+	group.convert = convert;
+	group.rb_frame_size = file_frame_size;
+
+	if(!group.rb.map_file(fd, data_offset, data_len)) {
+		fprintf(stderr, "error: %s: mmap failed: %s\n", path, strerror(errno));
+		::close(fd);
+		return false;
+	}
+	::close(fd);
+
+	m_mapped = true;
 	player.set_channel_count(m_channel_count);
+
+	group.wavecache.allocate(group.depth, group.channel_count);
+	group.wavecache.build(group.rb.peek(), m_sample_type, group.depth, convert, file_frame_size);
+	return true;
+}
+
+
+// Time of the newest frame, stream frames are numbered from the start of
+// the capture
+
+Time Stream::duration()
+{
+	Time t = 0.0;
+	for(auto &group : m_groups) {
+		t = std::max(t, group->rb.head() / group->rb_frame_size / group->srate);
+	}
+	return t;
 }
 
 
-Sample *Stream::peek(size_t *stride, size_t *frames_avail)
+// Bytes held in the ring buffers
+
+size_t Stream::bytes_used()
 {
-	size_t bytes_used;
-	Sample *data = (Sample *)m_rb.peek(&bytes_used);
-	if(stride) *stride = m_channel_count;
-	if(frames_avail) *frames_avail = bytes_used / m_frame_size;
-	return data;
+	size_t bytes = 0;
+	for(auto &group : m_groups) {
+		bytes += group->rb.bytes_used();
+	}
+	return bytes;
 }
 
 
-Wavecache::Range *Stream::peek_wavecache(size_t *stride, size_t *frames_avail)
+// Range of group frames of channel ch that can be read, from the ring buffer
+// or from the recording on disk
+
+void Stream::range(size_t ch, size_t *frame_from, size_t *frame_to)
 {
-	return m_wavecache.peek(frames_avail, stride);
+	Group &group = group_of(ch);
+	size_t used;
+	size_t pos;
+	group.rb.peek(&used, &pos);
+	*frame_from = std::min(pos / group.rb_frame_size, recorder.frame_first(m_channel_group[ch]));
+	*frame_to = (pos + used) / group.rb_frame_size;
 }
 
 
+// Read frame_count frames of the group holding channel ch, starting at group
+// frame frame. Returns a pointer to channel ch of the first frame, so sample
+// n of the channel is found at data[n * stride], or nullptr if the range is
+// not available. Recent frames are served from the ring buffer, older ones
+// from the recording on disk. Ranges within one ring buffer or chunk are
+// returned in place, others are gathered in buf, with frames missing from the
+// recording left silent. Groups mapped from files in other sample formats are
+// always converted into buf. If in_ring is set, the data points into the ring
+// buffer and must be checked with read_valid() after use.
+
+void *Stream::read(size_t ch, size_t frame, size_t frame_count, size_t *stride, std::vector<uint8_t> &buf, bool *in_ring)
+{
+	Group &group = group_of(ch);
+	size_t g = m_channel_group[ch];
+	size_t frame_size = group.frame_size;
+	size_t rb_frame_size = group.rb_frame_size;
+	size_t ch_offset = (ch - group.channel_first) * sample_type_size(m_sample_type);
+	*stride = group.channel_count;
+	if(in_ring) *in_ring = false;
+
+	size_t used;
+	size_t pos;
+	uint8_t *ring = (uint8_t *)group.rb.peek(&used, &pos);
+	size_t ring_from = pos / rb_frame_size;
+	size_t ring_to = (pos + used) / rb_frame_size;
+
+	if(frame + frame_count > ring_to) return nullptr;
+
+	if(frame >= ring_from && !group.convert) {
+		if(in_ring) *in_ring = true;
+		return ring + (frame - ring_from) * frame_size + ch_offset;
+	}
+
+	size_t n_disk;
+	const uint8_t *disk;
+	if(frame < ring_from) {
+		if(frame < recorder.frame_first(g)) return nullptr;
+		disk = recorder.map(g, frame, &n_disk);
+		if(disk && n_disk >= frame_count) {
+			return (void *)(disk + ch_offset);
+		}
+	}
 
+	buf.resize(frame_count * frame_size);
+	uint8_t *dst = buf.data();
+	size_t i = 0;
+	while(i < frame_count) {
+		size_t f = frame + i;
+		size_t n = frame_count - i;
+		if(f >= ring_from) {
+			// the copy is stable, so check it right away
+			const uint8_t *src = ring + (f - ring_from) * rb_frame_size;
+			if(group.convert) {
+				group.convert((Sample *)(dst + i * frame_size), src, n * group.channel_count);
+			} else {
+				memcpy(dst + i * frame_size, src, n * frame_size);
+			}
+			if(!group.rb.valid(f * rb_frame_size)) {
+				memset(dst + i * frame_size, 0, n * frame_size);
+			}
+		} else if((disk = recorder.map(g, f, &n_disk))) {
+			n = std::min(n, n_disk);
+			memcpy(dst + i * frame_size, disk, n * frame_size);
+		} else {
+			n = std::min({n, n_disk, ring_from - f});
+			memset(dst + i * frame_size, 0, n * frame_size);
+		}
+		i += n;
+	}
+	return dst + ch_offset;
+}
+
+
+// Check if a frame read from the ring buffer has not been overwritten by the
+// capture thread in the mean time. Frames are retired oldest first, so if
+// this holds for the first frame read it holds for all later frames as well.
+
+bool Stream::read_valid(size_t ch, size_t frame)
+{
+	Group &group = group_of(ch);
+	return group.rb.valid(frame * group.rb_frame_size);
+}
+
+
+// Start loading the recorded frames of the given time span from disk
+
+void Stream::prefetch(Time t_from, Time t_to)
+{
+	for(size_t g=0; g<m_groups.size(); g++) {
+		Group &group = *m_groups[g];
+		size_t frame_oldest = group.rb.head() / group.rb_frame_size - group.rb.bytes_used() / group.rb_frame_size;
+		size_t frame_from = std::max(t_from, 0.0) * group.srate;
+		size_t frame_to = std::min((size_t)(std::max(t_to, 0.0) * group.srate), frame_oldest);
+		if(frame_from < frame_to) {
+			recorder.prefetch(g, frame_from, frame_to);
+		}
+	}
+}
+
+
+Wavecache::Range *Stream::peek_wavecache(size_t ch, size_t level, size_t *stride, size_t *frames_avail, size_t *seq)
+{
+	Group &group = group_of(ch);
+	Wavecache::Range *data = group.wavecache.peek(level, frames_avail, stride, seq);
+	return data + (ch - group.channel_first);
+}
@@ -7,13 +7,18 @@
 #include <stddef.h>
 #include <thread>
 #include <atomic>
+#include <memory>
 
 #include "rb.hpp"
 #include "config.hpp"
 #include "types.hpp"
+#include "convert.hpp"
 #include "wavecache.hpp"
+#include "discontinuity.hpp"
 #include "player.hpp"
 #include "capture.hpp"
+#include "pipeline.hpp"
+#include "recorder.hpp"
 
 
 class Source;
@@ -21,31 +26,83 @@ class Source;
 class Stream {
 public:
 
+	// A group of channels sharing one sample rate, stored interleaved in
+	// its own ring buffer with its own wavecache and discontinuity index.
+	// Stream channels are numbered group after group.
+	struct Group {
+		Samplerate srate{};
+		size_t channel_first{};
+		size_t channel_count{};
+		size_t frame_size{};
+		size_t depth{};
+		Rb rb;
+		// Files in sample formats other than the stream sample type stay
+		// mapped in their own format and are converted by read(), so ring
+		// positions count frames of rb_frame_size bytes. Only read() may
+		// access the ring buffer of such a group.
+		ConvertFn convert{};
+		size_t rb_frame_size{};
+		Wavecache wavecache;
+		Discontinuities discontinuities;
+	};
+
 	Stream();
 	~Stream();
 	void load(ConfigReader::Node *node);
 	void save(ConfigWriter &cfg);
 
 	void set_sample_rate(Samplerate srate);
+	void set_sample_type(SampleType type) { m_sample_type = type; }
 	size_t channel_count() { return m_channel_count; }
-	void allocate(size_t depth);
+	SampleType sample_type() { return m_sample_type; }
+	void allocate(size_t depth, int rb_flags = 0);
+	bool open_file(const char *path, char *spec);
+	bool mapped() { return m_mapped; }
 	Samplerate sample_rate() { return m_srate; }
-	Sample *peek(size_t *stride, size_t *frames_avail = nullptr);
-	Wavecache::Range *peek_wavecache(size_t *stride, size_t *used = nullptr);
-	Rb &rb() { return m_rb; }
-	Wavecache &wavecache() { return m_wavecache; }
+	Samplerate sample_rate(size_t ch) { return group_of(ch).srate; }
+	size_t group_count() { return m_groups.size(); }
+	Group &group(size_t idx) { return *m_groups[idx]; }
+	Group &group_of(size_t ch) { return *m_groups[m_channel_group[ch]]; }
+	Time duration();
+	size_t bytes_used();
+	void range(size_t ch, size_t *frame_from, size_t *frame_to);
+	void *read(size_t ch, size_t frame, size_t frame_count, size_t *stride, std::vector<uint8_t> &buf, bool *in_ring = nullptr);
+	bool read_valid(size_t ch, size_t frame);
+	void prefetch(Time t_from, Time t_to);
+	Wavecache::Range *peek_wavecache(size_t ch, size_t level, size_t *stride, size_t *used = nullptr, size_t *seq = nullptr);
+	Discontinuities &discontinuities(size_t ch) { return group_of(ch).discontinuities; }
 	
 	Player player;
 	Capture capture;
+	Pipeline pipeline;
+	Recorder recorder;
 
 private:
 
-	size_t m_depth{};
+	// Pipeline stage feeding the group wavecaches and telling the main
+	// thread about new frames
+	class Display : public Pipeline::Stage {
+	public:
+		Display(Stream &stream) : m_stream(stream) {}
+		void process(size_t group, const uint8_t *data, size_t frame, size_t frame_count) override;
+		void skip(size_t group, size_t frame, size_t frame_count) override;
+		void idle() override;
+	private:
+		Stream &m_stream;
+		uint64_t m_t_event{};
+		size_t m_frame_event{};
+		size_t m_frames_event{};
+	};
+
+	Group &add_group(Samplerate srate, size_t channel_count);
+
 	size_t m_channel_count{};
-	size_t m_frame_size{};
-	Rb m_rb;
-	Wavecache m_wavecache;
+	SampleType m_sample_type{SampleType::S16};
+	std::vector<std::unique_ptr<Group>> m_groups{};
+	std::vector<size_t> m_channel_group{};
 	Samplerate m_srate{};
+	bool m_mapped{false};
+	Display m_display{*this};
 
 
 public:
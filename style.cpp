@@ -24,6 +24,7 @@ static ColorDef colordef_list[Style::COUNT] = {
 	DEF_COLOR(PanelBorder,       0.00, 0.50, 0.50, 1.00),
 	DEF_COLOR(ToggleButtonOff,   0.26, 0.26, 0.38, 1.00),
 	DEF_COLOR(ToggleButtonOn,    0.26, 0.59, 0.98, 1.00),
+	DEF_COLOR(Discontinuity,     1.00, 0.20, 0.20, 0.35),
 
 	// https://medialab.github.io/iwanthue/
 	DEF_COLOR(Channel1,          0.00, 0.60, 0.80, 1.00),
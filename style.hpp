@@ -28,6 +28,7 @@ public:
 		PanelBorder,
 		ToggleButtonOff,
 		ToggleButtonOn,
+		Discontinuity,
 		Channel1, Channel2, Channel3, Channel4,
 		Channel5, Channel6, Channel7, Channel8,
 		ChannelDisabled,
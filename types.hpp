@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 
 typedef double Time;
 typedef double Frequency;
@@ -16,30 +17,49 @@ struct Range {
 
 static const int k_user_event_audio_capture = 1;
 static const int k_user_event_audio_playback = 2;
+static const int k_user_event_wavecache = 3;
 
-#define SAMPLE_S16
-//#define SAMPLE_FLOAT16
-//#define SAMPLE_FLOAT
-//#define SAMPLE_DOUBLE
+// Sources and the capture pipeline work on normalized float samples; the
+// stream stores them in the sample type selected at startup
 
-#ifdef SAMPLE_S16
-typedef int16_t Sample;
-static constexpr Sample k_sample_max = 32767;
-#endif
-
-#ifdef SAMPLE_FLOAT16
-typedef _Float16 Sample;
-static constexpr Sample k_sample_max = 1.0f;
-#endif
-
-#ifdef SAMPLE_FLOAT
 typedef float Sample;
 static constexpr Sample k_sample_max = 1.0f;
-#endif
 
-#ifdef SAMPLE_DOUBLE
-typedef double Sample;
-static constexpr Sample k_sample_max = 1.0;
-#endif
+enum class SampleType { S16, F16, F32 };
+
+template<typename T> struct SampleTraits;
+
+template<> struct SampleTraits<int16_t> {
+	static constexpr SampleType type = SampleType::S16;
+	static constexpr float max = 32767.0f;
+};
+
+template<> struct SampleTraits<_Float16> {
+	static constexpr SampleType type = SampleType::F16;
+	static constexpr float max = 1.0f;
+};
+
+template<> struct SampleTraits<float> {
+	static constexpr SampleType type = SampleType::F32;
+	static constexpr float max = 1.0f;
+};
+
+inline size_t sample_type_size(SampleType type)
+{
+	return type == SampleType::F32 ? 4 : 2;
+}
+
+// Call fn with data cast to a pointer of the given sample type. Hot paths are
+// written as templates over the sample type and dispatched once per block.
+
+template<typename Fn>
+auto sample_dispatch(SampleType type, const void *data, Fn &&fn)
+{
+	switch(type) {
+		case SampleType::S16: return fn((const int16_t *)data);
+		case SampleType::F16: return fn((const _Float16 *)data);
+		default: return fn((const float *)data);
+	}
+}
 
 
@@ -1,52 +1,385 @@
 
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include <type_traits>
+#include <experimental/simd>
+
 #include "stream.hpp"
 #include "wavecache.hpp"
 
-Wavecache::Wavecache(size_t step)
-	: m_step(step)
+// number of ranges computed per job when building from a complete buffer
+static const size_t k_build_chunk = 4096;
+
+// number of samples converted per block when feeding other sample types
+static const size_t k_feed_samples = 4096;
+
+namespace stdx = std::experimental;
+
+
+// Fold frame_count frames of N channels into their ranges, starting new
+// ranges if first is set. The channels of a frame are processed as one
+// vector. Samples and squares are summed in float over the block, which is at
+// most one range of the first level, and added to the double sums afterwards.
+
+template<size_t N>
+static void reduce(Wavecache::Range *out, const Sample *src, size_t stride, size_t frame_count, bool first)
+{
+	using V = stdx::fixed_size_simd<Sample, N>;
+	V vmin, vmax;
+	V vsum = 0.0f;
+	V vsum_sq = 0.0f;
+	if(first) {
+		vmin = vmax = V(src, stdx::element_aligned);
+	} else {
+		vmin = V([&](auto i) { return out[i].min; });
+		vmax = V([&](auto i) { return out[i].max; });
+	}
+	for(size_t f=0; f<frame_count; f++) {
+		V v(src, stdx::element_aligned);
+		vmin = stdx::min(vmin, v);
+		vmax = stdx::max(vmax, v);
+		vsum += v;
+		vsum_sq += v * v;
+		src += stride;
+	}
+	for(size_t i=0; i<N; i++) {
+		out[i].min = vmin[i];
+		out[i].max = vmax[i];
+		out[i].sum = (first ? 0.0 : out[i].sum) + vsum[i];
+		out[i].sum_sq = (first ? 0.0 : out[i].sum_sq) + vsum_sq[i];
+	}
+}
+
+
+// Fold frames of any number of channels, in vectors of up to 16 channels
+
+static void reduce_n(Wavecache::Range *out, const Sample *src, size_t channel_count, size_t frame_count, bool first)
+{
+	size_t ch = 0;
+	for(; ch+16<=channel_count; ch+=16) {
+		reduce<16>(out + ch, src + ch, channel_count, frame_count, first);
+	}
+	if(ch+8 <= channel_count) { reduce<8>(out + ch, src + ch, channel_count, frame_count, first); ch += 8; }
+	if(ch+4 <= channel_count) { reduce<4>(out + ch, src + ch, channel_count, frame_count, first); ch += 4; }
+	if(ch+2 <= channel_count) { reduce<2>(out + ch, src + ch, channel_count, frame_count, first); ch += 2; }
+	if(ch+1 <= channel_count) { reduce<1>(out + ch, src + ch, channel_count, frame_count, first); ch += 1; }
+}
+
+
+Wavecache::Wavecache()
+{
+	size_t step = k_level_step;
+	for(auto &level : m_levels) {
+		level.step = step;
+		step *= k_level_factor;
+	}
+}
+
+
+Wavecache::~Wavecache()
 {
+	build_stop();
 }
 
 
-void Wavecache::allocate(size_t depth, size_t channel_count)
+void Wavecache::allocate(size_t depth, size_t channel_count, int rb_flags)
 {
+	build_stop();
+
 	m_channel_count = channel_count;
 	m_frame_size = channel_count * sizeof(Range);
-	m_n = 0;
-	m_rb.set_size(depth * m_frame_size / m_step);
+	m_frames = 0;
+	for(size_t i=0; i<k_level_count; i++) {
+		Level &level = m_levels[i];
+		size_t frames = (i == 0) ? depth : depth * k_history_factor;
+		size_t range_count = (frames + level.step - 1) / level.step + 1;
+		level.n = 0;
+		level.rb.set_size(range_count * m_frame_size, rb_flags);
+	}
+}
+
+
+// Coarsest level with at most frames_per_entry frames per range, so drawing
+// from it takes about one range per entry
+
+size_t Wavecache::level_for(double frames_per_entry)
+{
+	size_t level = 0;
+	while(level + 1 < k_level_count && m_levels[level + 1].step <= frames_per_entry) {
+		level ++;
+	}
+	return level;
 }
 
 
-Wavecache::Range *Wavecache::peek(size_t *frames_avail, size_t *stride)
+// Snapshot of the cached ranges of a level; seq is the range number of the
+// first one
+
+Wavecache::Range *Wavecache::peek(size_t level, size_t *frames_avail, size_t *stride, size_t *seq)
 {
 	size_t bytes_used;
-	Range *data = (Range *)m_rb.peek(&bytes_used);
+	size_t pos;
+	Range *data = (Range *)m_levels[level].rb.peek(&bytes_used, &pos);
 	if(frames_avail) *frames_avail = bytes_used / m_frame_size;
+	if(seq) *seq = pos / m_frame_size;
 	if(stride) *stride = m_channel_count;
 	return data;
 }
 
 
-void Wavecache::feed_frames(Sample *buf, size_t frame_count, size_t channel_count)
+// Feed frames in the stream sample type, converting them in blocks
+
+void Wavecache::feed(const void *buf, SampleType type, size_t frame_count)
 {
-	Range *pout = (Range *)m_rb.write_ptr();
+	sample_dispatch(type, buf, [&](auto *src) {
+		using T = std::remove_cvref_t<decltype(*src)>;
+		if constexpr (std::is_same_v<T, Sample>) {
+			feed_frames(src, frame_count, m_channel_count);
+		} else {
+			constexpr float scale = 1.0f / SampleTraits<T>::max;
+			size_t block_frames = std::max(k_feed_samples / m_channel_count, (size_t)1);
+			m_feed_buf.resize(block_frames * m_channel_count);
+			for(size_t i=0; i<frame_count; i+=block_frames) {
+				size_t n = std::min(block_frames, frame_count - i);
+				for(size_t j=0; j<n * m_channel_count; j++) {
+					m_feed_buf[j] = src[j] * scale;
+				}
+				feed_frames(m_feed_buf.data(), n, m_channel_count);
+				src += n * m_channel_count;
+			}
+		}
+	});
+}
+
+
+void Wavecache::feed_frames(const Sample *buf, size_t frame_count, size_t channel_count)
+{
+	Level &l = m_levels[0];
+
+	// reserve room for all completed ranges plus the one being accumulated
+	size_t ranges_max = (l.n + frame_count) / l.step + 1;
+	size_t bytes_max = std::min(ranges_max * m_frame_size, l.rb.size());
+	Range *pout = (Range *)l.rb.write_ptr(bytes_max);
+	Range *done = pout;
 	size_t frames_out = 0;
-	for(size_t i=0; i<frame_count; i++) {
-		for(size_t ch=0; ch<channel_count; ch++) {
-			const Sample v = buf[ch];
-			pout[ch].min = m_n == 0 ? v : std::min(pout[ch].min, v);
-			pout[ch].max = m_n == 0 ? v : std::max(pout[ch].max, v);
-		}
-		m_n ++;
-		if(m_n == m_step) {
+	size_t i = 0;
+	while(i < frame_count) {
+		size_t n = std::min(l.step - l.n, frame_count - i);
+		reduce_n(pout, buf, channel_count, n, l.n == 0);
+		l.n += n;
+		if(l.n == l.step) {
 			pout += channel_count;
 			frames_out ++;
-			m_n = 0;
+			l.n = 0;
+		}
+		buf += n * channel_count;
+		i += n;
+	}
+	l.rb.write_done(m_frame_size * frames_out);
+	m_frames += frame_count;
+	feed_ranges(1, done, frames_out);
+}
+
+
+// Account for frame_count frames that were never fed, keeping the range
+// numbers aligned with the stream frames. The skipped ranges read as silence.
+
+void Wavecache::skip(size_t frame_count)
+{
+	size_t frames = m_frames + frame_count;
+	size_t step_below = 1;
+
+	for(auto &l : m_levels) {
+		size_t ranges = frames / l.step - m_frames / l.step;
+		while(ranges > 0) {
+			size_t n = std::min(ranges, l.rb.size() / m_frame_size);
+			void *p = l.rb.write_ptr(n * m_frame_size);
+			memset(p, 0, n * m_frame_size);
+			l.rb.write_done(n * m_frame_size);
+			ranges -= n;
+		}
+		// restart the range being accumulated from silence
+		memset(l.rb.write_ptr(m_frame_size), 0, m_frame_size);
+		l.n = frames % l.step / step_below;
+		step_below = l.step;
+	}
+
+	m_frames = frames;
+}
+
+
+// Merge completed ranges of the level below into the given level
+
+void Wavecache::feed_ranges(size_t level, const Range *buf, size_t range_count)
+{
+	if(level >= k_level_count || range_count == 0) return;
+
+	Level &l = m_levels[level];
+	size_t factor = l.step / m_levels[level - 1].step;
+	size_t ranges_max = (l.n + range_count) / factor + 1;
+	size_t bytes_max = std::min(ranges_max * m_frame_size, l.rb.size());
+	Range *pout = (Range *)l.rb.write_ptr(bytes_max);
+	Range *done = pout;
+	size_t frames_out = 0;
+	for(size_t i=0; i<range_count; i++) {
+		for(size_t ch=0; ch<m_channel_count; ch++) {
+			if(l.n == 0) {
+				pout[ch] = buf[ch];
+			} else {
+				pout[ch].min = std::min(pout[ch].min, buf[ch].min);
+				pout[ch].max = std::max(pout[ch].max, buf[ch].max);
+				pout[ch].sum += buf[ch].sum;
+				pout[ch].sum_sq += buf[ch].sum_sq;
+			}
+		}
+		l.n ++;
+		if(l.n == factor) {
+			pout += m_channel_count;
+			frames_out ++;
+			l.n = 0;
+		}
+		buf += m_channel_count;
+	}
+	l.rb.write_done(m_frame_size * frames_out);
+	feed_ranges(level + 1, done, frames_out);
+}
+
+
+// Build the cache for a complete buffer, like a mapped file, on background
+// threads. Chunks of ranges of the first level are computed in parallel and
+// published in order, so readers see the cache grow from the start of the
+// buffer. The coarser levels are merged from them while publishing. If
+// convert is given, buf holds frames of src_frame_size bytes in another
+// format, which each job converts to Sample first.
+
+void Wavecache::build(const void *buf, SampleType type, size_t frame_count, ConvertFn convert, size_t src_frame_size)
+{
+	build_stop();
+
+	Level &l = m_levels[0];
+	size_t range_count = (frame_count + l.step - 1) / l.step;
+	size_t bytes = range_count * m_frame_size;
+	assert(bytes <= l.rb.size());
+
+	Build &b = m_build;
+	b.buf = buf;
+	b.type = type;
+	b.convert = convert;
+	b.src_frame_size = src_frame_size;
+	b.frame_count = frame_count;
+	b.out = (Range *)l.rb.write_ptr(bytes);
+	b.chunk_count = (range_count + k_build_chunk - 1) / k_build_chunk;
+	b.next = 0;
+	b.published = 0;
+	b.done.assign(b.chunk_count, false);
+	b.stop = false;
+
+	size_t thread_count = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+	thread_count = std::min(thread_count, b.chunk_count);
+	for(size_t i=0; i<thread_count; i++) {
+		b.threads.emplace_back(&Wavecache::build_thread, this);
+	}
+}
+
+
+void Wavecache::build_stop()
+{
+	m_build.stop = true;
+	for(auto &t : m_build.threads) {
+		t.join();
+	}
+	m_build.threads.clear();
+}
+
+
+// Compute ranges r0 to r1 of the first level, buf holding the frames from
+// frame_base on
+
+template<typename T>
+void Wavecache::build_ranges(const T *buf, size_t frame_base, size_t r0, size_t r1)
+{
+	Build &b = m_build;
+	size_t step = m_levels[0].step;
+	constexpr float scale = 1.0f / SampleTraits<T>::max;
+	std::vector<T> vmin(m_channel_count);
+	std::vector<T> vmax(m_channel_count);
+	std::vector<float> vsum(m_channel_count);
+	std::vector<float> vsum_sq(m_channel_count);
+
+	for(size_t r=r0; r<r1; r++) {
+		size_t f0 = r * step;
+		size_t f1 = std::min(f0 + step, b.frame_count);
+		Range *pout = b.out + r * m_channel_count;
+		const T *p = buf + (f0 - frame_base) * m_channel_count;
+		for(size_t ch=0; ch<m_channel_count; ch++) {
+			vmin[ch] = vmax[ch] = p[ch];
+			vsum[ch] = 0.0f;
+			vsum_sq[ch] = 0.0f;
+		}
+		for(size_t f=f0; f<f1; f++) {
+			for(size_t ch=0; ch<m_channel_count; ch++) {
+				float v = p[ch] * scale;
+				vmin[ch] = std::min(vmin[ch], p[ch]);
+				vmax[ch] = std::max(vmax[ch], p[ch]);
+				vsum[ch] += v;
+				vsum_sq[ch] += v * v;
+			}
+			p += m_channel_count;
+		}
+		for(size_t ch=0; ch<m_channel_count; ch++) {
+			pout[ch].min = vmin[ch] * scale;
+			pout[ch].max = vmax[ch] * scale;
+			pout[ch].sum = vsum[ch];
+			pout[ch].sum_sq = vsum_sq[ch];
 		}
-		buf += channel_count;
 	}
-	m_rb.write_done(m_frame_size * frames_out);
 }
 
 
+void Wavecache::build_thread()
+{
+	Build &b = m_build;
+	Level &l = m_levels[0];
+	size_t range_count = (b.frame_count + l.step - 1) / l.step;
+	std::vector<Sample> converted;
+
+	while(!b.stop) {
+		size_t chunk = b.next++;
+		if(chunk >= b.chunk_count) break;
 
+		size_t r0 = chunk * k_build_chunk;
+		size_t r1 = std::min(r0 + k_build_chunk, range_count);
+		if(b.convert) {
+			size_t f0 = r0 * l.step;
+			size_t f1 = std::min(r1 * l.step, b.frame_count);
+			converted.resize((f1 - f0) * m_channel_count);
+			b.convert(converted.data(), (const uint8_t *)b.buf + f0 * b.src_frame_size, converted.size());
+			build_ranges(converted.data(), f0, r0, r1);
+		} else {
+			sample_dispatch(b.type, b.buf, [&](auto *buf) {
+				build_ranges(buf, 0, r0, r1);
+			});
+		}
+
+		// publish the contiguous prefix of completed chunks
+		std::lock_guard<std::mutex> lock(b.mutex);
+		b.done[chunk] = true;
+		size_t ranges = 0;
+		Range *first = b.out + b.published * k_build_chunk * m_channel_count;
+		while(b.published < b.chunk_count && b.done[b.published]) {
+			size_t c0 = b.published * k_build_chunk;
+			ranges += std::min(c0 + k_build_chunk, range_count) - c0;
+			b.published ++;
+		}
+		if(ranges > 0) {
+			l.rb.write_done(ranges * m_frame_size);
+			feed_ranges(1, first, ranges);
+			SDL_Event event;
+			SDL_zero(event);
+			event.type = SDL_EVENT_USER;
+			event.user.code = k_user_event_wavecache;
+			SDL_PushEvent(&event);
+		}
+	}
+}
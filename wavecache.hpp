@@ -2,27 +2,80 @@
 #pragma once
 
 #include <inttypes.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
 
 
 class Wavecache {
 public:
+	// The sums give the mean and RMS envelopes; they are kept in double
+	// since the coarse levels sum up to millions of samples
 	struct Range {
 		Sample min;
 		Sample max;
+		double sum;
+		double sum_sq;
 	};
 
-	Wavecache(size_t step);
-	void allocate(size_t depth, size_t channel_count);
-	Range *peek(size_t *frames_avail, size_t *stride);
-	void feed_frames(Sample *buf, size_t frame_count, size_t channel_count);
+	// The cache is a pyramid of levels, level n holding the min/max of
+	// ranges of step(n) frames, each level built from the one below. Finer
+	// views are drawn from the frames themselves.
+	static const size_t k_level_count = 4;
+	static const size_t k_level_step = 256;
+	static const size_t k_level_factor = 16;
+
+	// The coarser levels reach this many times the ring depth back, so
+	// zoomed out views still show history evicted to the recording. Each of
+	// them takes at most as much memory as the first level.
+	static const size_t k_history_factor = 16;
+
+	Wavecache();
+	~Wavecache();
+	void allocate(size_t depth, size_t channel_count, int rb_flags = 0);
+	void build(const void *buf, SampleType type, size_t frame_count, ConvertFn convert = nullptr, size_t src_frame_size = 0);
+	size_t step(size_t level) { return m_levels[level].step; }
+	size_t level_for(double frames_per_entry);
+	Range *peek(size_t level, size_t *frames_avail, size_t *stride, size_t *seq = nullptr);
+	void feed(const void *buf, SampleType type, size_t frame_count);
+	void skip(size_t frame_count);
+	void feed_frames(const Sample *buf, size_t frame_count, size_t channel_count);
 
 
 private:
+	struct Level {
+		size_t step;
+		size_t n;
+		Rb rb;
+	};
+
 	size_t m_channel_count;
 	size_t m_frame_size;
-	size_t m_step;
-	size_t m_n;
-	Rb m_rb;
-};
+	Level m_levels[k_level_count];
+	std::vector<Sample> m_feed_buf{};
+	size_t m_frames{};
+
+	void feed_ranges(size_t level, const Range *buf, size_t range_count);
+	void build_stop();
+	void build_thread();
+	template<typename T>
+	void build_ranges(const T *buf, size_t frame_base, size_t r0, size_t r1);
 
+	struct Build {
+		const void *buf;
+		SampleType type;
+		ConvertFn convert;
+		size_t src_frame_size;
+		size_t frame_count;
+		Range *out;
+		size_t chunk_count;
+		std::atomic<size_t> next;
+		size_t published;
+		std::vector<bool> done;
+		std::atomic<bool> stop;
+		std::mutex mutex;
+		std::vector<std::thread> threads;
+	} m_build{};
+};
 
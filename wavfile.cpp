@@ -0,0 +1,122 @@
+
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "wavfile.hpp"
+#include "misc.hpp"
+
+
+static const uint16_t k_wave_format_pcm = 0x0001;
+static const uint16_t k_wave_format_float = 0x0003;
+static const uint16_t k_wave_format_extensible = 0xfffe;
+
+
+static uint16_t get_u16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+
+static uint32_t get_u32(const uint8_t *p)
+{
+	return get_u16(p) | ((uint32_t)get_u16(p + 2) << 16);
+}
+
+
+static uint64_t get_u64(const uint8_t *p)
+{
+	return get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+
+static SDL_AudioFormat wave_format(uint16_t tag, uint16_t bits)
+{
+	if(tag == k_wave_format_pcm) {
+		if(bits == 8) return SDL_AUDIO_U8;
+		if(bits == 16) return SDL_AUDIO_S16LE;
+		if(bits == 24) return k_sdl_audio_s24le;
+		if(bits == 32) return SDL_AUDIO_S32LE;
+	}
+	if(tag == k_wave_format_float) {
+		if(bits == 32) return SDL_AUDIO_F32LE;
+	}
+	return SDL_AUDIO_UNKNOWN;
+}
+
+
+// Parse the header of a RIFF/WAVE or RF64 file and find the location of the
+// sample data. Returns NotWave if fd does not hold a wave file at all, and
+// Unsupported if it does but its sample format can not be read or the file
+// is damaged.
+
+WavStatus wavfile_parse(int fd, SDL_AudioSpec &spec, size_t *data_offset, size_t *data_len)
+{
+	uint8_t hdr[12];
+	if(pread(fd, hdr, sizeof(hdr), 0) != sizeof(hdr)) return WavStatus::NotWave;
+
+	bool rf64 = memcmp(hdr, "RF64", 4) == 0;
+	if(!rf64 && memcmp(hdr, "RIFF", 4) != 0) return WavStatus::NotWave;
+	if(memcmp(hdr + 8, "WAVE", 4) != 0) return WavStatus::NotWave;
+
+	struct stat st;
+	if(fstat(fd, &st) != 0) return WavStatus::Unsupported;
+	size_t file_size = st.st_size;
+
+	uint64_t ds64_data_size = 0;
+	bool got_fmt = false;
+	size_t off = 12;
+
+	while(off + 8 <= file_size) {
+		uint8_t chunk[8];
+		if(pread(fd, chunk, sizeof(chunk), off) != sizeof(chunk)) return WavStatus::Unsupported;
+		uint64_t size = get_u32(chunk + 4);
+		off += 8;
+
+		if(memcmp(chunk, "ds64", 4) == 0) {
+			uint8_t ds64[24];
+			if(size < sizeof(ds64)) return WavStatus::Unsupported;
+			if(pread(fd, ds64, sizeof(ds64), off) != sizeof(ds64)) return WavStatus::Unsupported;
+			ds64_data_size = get_u64(ds64 + 8);
+		}
+
+		if(memcmp(chunk, "fmt ", 4) == 0) {
+			uint8_t fmt[40]{};
+			if(size < 16) return WavStatus::Unsupported;
+			size_t n = size < sizeof(fmt) ? size : sizeof(fmt);
+			if(pread(fd, fmt, n, off) != (ssize_t)n) return WavStatus::Unsupported;
+			uint16_t tag = get_u16(fmt + 0);
+			uint16_t bits = get_u16(fmt + 14);
+			if(tag == k_wave_format_extensible && n >= 26) {
+				tag = get_u16(fmt + 24);
+			}
+			spec.format = wave_format(tag, bits);
+			spec.channels = get_u16(fmt + 2);
+			spec.freq = get_u32(fmt + 4);
+			if(spec.format == SDL_AUDIO_UNKNOWN) {
+				fprintf(stderr, "wave format 0x%04x with %d bits per sample not supported\n", tag, bits);
+				return WavStatus::Unsupported;
+			}
+			if(spec.channels == 0) return WavStatus::Unsupported;
+			got_fmt = true;
+		}
+
+		if(memcmp(chunk, "data", 4) == 0) {
+			if(!got_fmt) return WavStatus::Unsupported;
+			// RF64 stores the real size in the ds64 chunk; a data size of
+			// 0xffffffff also shows up in unterminated recordings
+			if(rf64 && size == 0xffffffff) size = ds64_data_size;
+			if(size == 0xffffffff || off + size > file_size) size = file_size - off;
+			size_t frame_size = spec.channels * SDL_AUDIO_BYTESIZE(spec.format);
+			*data_offset = off;
+			*data_len = size - size % frame_size;
+			return WavStatus::Ok;
+		}
+
+		off += size + (size & 1);
+	}
+
+	return WavStatus::Unsupported;
+}
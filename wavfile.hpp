@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <SDL3/SDL_audio.h>
+
+enum class WavStatus { NotWave, Unsupported, Ok };
+
+WavStatus wavfile_parse(int fd, SDL_AudioSpec &spec, size_t *data_offset, size_t *data_len);
@@ -26,8 +26,9 @@ private:
 	void do_draw_colors_tab(Stream &stream, SDL_Renderer *rend, SDL_Rect &r);
 	void draw_vu(Stream &stream, size_t channel, Style::Color col);
 
-	ssize_t m_vu_idx_prev{0};
+	std::vector<ssize_t> m_vu_idx_prev{};
 	std::vector<Sample> m_vu_peak{};
+	std::vector<Sample> m_vu_rms{};
 };
 
 
@@ -86,11 +87,16 @@ void WidgetChannels::draw_vu(Stream &stream, size_t ch, Style::Color col)
 	pos.x += 4;
 
 	float db_range = 60.0f;
-	float db = 20.0f * log10f((float)m_vu_peak[ch]/k_sample_max + 1e-10f);
-	float db_clamped = std::clamp(db, -db_range, 0.0f);
-	float x = (db_clamped + db_range) / db_range * width;
-
-	for(float i=0; i<x-8; i+=8) {
+	auto to_x = [&](Sample v) {
+		float db = 20.0f * log10f((float)v/k_sample_max + 1e-10f);
+		float db_clamped = std::clamp(db, -db_range, 0.0f);
+		return (db_clamped + db_range) / db_range * width;
+	};
+	float x = to_x(m_vu_peak[ch]);
+	float x_rms = to_x(m_vu_rms[ch]);
+
+	// rms level as bar, peak level as marker
+	for(float i=0; i<x_rms-4; i+=8) {
 		draw_list->AddRectFilled(ImVec2(pos.x + i, pos.y), ImVec2(pos.x + i + 4, pos.y + height - 8),
 			IM_COL32(64, 64, 64, 255));
 	}
@@ -105,23 +111,61 @@ void WidgetChannels::draw_vu(Stream &stream, size_t ch, Style::Color col)
 void WidgetChannels::do_draw_playback_tab(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 {
 	m_vu_peak.resize(stream.channel_count());
-
-	size_t frames_stride;
-	size_t frames_avail;
-	Sample *frames_data = stream.peek(&frames_stride, &frames_avail);
-	ssize_t idx_to   = std::min((ssize_t)(m_view.time.analysis * stream.sample_rate()), (ssize_t)frames_avail);
-	ssize_t idx_from = std::max({m_vu_idx_prev, idx_to - 10000, (ssize_t)0 });
-	m_vu_idx_prev = idx_to;
+	m_vu_rms.resize(stream.channel_count());
+	m_vu_idx_prev.resize(stream.channel_count());
 
 	double fps = ImGui::GetIO().Framerate;
 	double decay = exp2(-1.0 / (fps * 0.150)); 
 	
 	for(size_t ch=0; ch<stream.channel_count(); ch++) {
+		size_t frame_first, frame_end;
+		stream.range(ch, &frame_first, &frame_end);
+		ssize_t idx_to   = std::min((ssize_t)(m_view.time.analysis * stream.sample_rate(ch)), (ssize_t)frame_end);
+		ssize_t idx_from = std::max({m_vu_idx_prev[ch], idx_to - 10000, (ssize_t)frame_first });
+		m_vu_idx_prev[ch] = idx_to;
 		m_vu_peak[ch] *= decay;
-		for(ssize_t idx=idx_from; idx<idx_to; idx++) {
-			Sample v = frames_data[idx * frames_stride + ch];
-			m_vu_peak[ch] = std::max(m_vu_peak[ch], v);
+		m_vu_rms[ch] *= decay;
+		if(idx_from >= idx_to) continue;
+
+		Sample peak = 0.0f;
+		double sum_sq = 0.0;
+		size_t n = 0;
+
+		// use the precomputed ranges of the wavecache if it holds the
+		// whole span, the raw frames otherwise
+		Wavecache &wavecache = stream.group_of(ch).wavecache;
+		size_t wstep = wavecache.step(0);
+		size_t r_from = idx_from / wstep;
+		size_t r_to = idx_to / wstep;
+		size_t wstride, wavail, wseq;
+		Wavecache::Range *wdata = stream.peek_wavecache(ch, 0, &wstride, &wavail, &wseq);
+
+		if(r_from < r_to && r_from >= wseq && r_to <= wseq + wavail) {
+			for(size_t r=r_from; r<r_to; r++) {
+				Wavecache::Range &range = wdata[(r - wseq) * wstride];
+				peak = std::max({peak, range.max, -range.min});
+				sum_sq += range.sum_sq;
+			}
+			n = (r_to - r_from) * wstep;
+		} else {
+			size_t frames_stride;
+			void *frames_data = stream.read(ch, idx_from, idx_to - idx_from, &frames_stride, m_read_buf);
+			if(frames_data == nullptr) continue;
+
+			sample_dispatch(stream.sample_type(), frames_data, [&](auto *data) {
+				using T = std::remove_cvref_t<decltype(*data)>;
+				constexpr Sample scale = 1.0f / SampleTraits<T>::max;
+				for(ssize_t idx=0; idx<idx_to-idx_from; idx++) {
+					Sample v = data[idx * frames_stride] * scale;
+					peak = std::max(peak, fabsf(v));
+					sum_sq += v * v;
+				}
+			});
+			n = idx_to - idx_from;
 		}
+
+		m_vu_peak[ch] = std::max(m_vu_peak[ch], peak);
+		m_vu_rms[ch] = std::max(m_vu_rms[ch], (Sample)sqrt(sum_sq / n));
 	}
 
 
@@ -75,30 +75,38 @@ void WidgetHistogram::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 	ImGui::SetNextItemWidth(100);
 	ImGui::SliderInt("##nbins", &m_nbins, 16, 1024, "%d", ImGuiSliderFlags_Logarithmic);
 		
-	size_t frames_stride;
-	size_t frames_avail;
-	Sample *frames_data = stream.peek(&frames_stride, &frames_avail);
-
 	for(auto & h : m_hists) {
 		h.set_range(m_vmin, m_vmax);
 		h.set_nbins(m_nbins);
 		h.clear();
 	}
 	
-	Sample vmin = frames_data[0];
-	Sample vmax = frames_data[0];
-
-	int idx_analysis = m_view.time.analysis * stream.sample_rate();
-	int idx_from = std::max(idx_analysis - m_view.window.size * 0.5, 0.0);
-	int idx_to   = std::min(idx_analysis + m_view.window.size * 0.5, (double)frames_avail);
-
-	for(int idx=idx_from; idx<idx_to; idx++) {
-		for(int ch : m_channel_map.enabled_channels()) {
-			Sample v = frames_data[idx * frames_stride + ch];
-			m_hists[ch].add(v);
-			vmin = std::min(vmin, v);
-			vmax = std::max(vmax, v);
-		}
+	Sample vmin = 0;
+	Sample vmax = 0;
+
+	for(int ch : m_channel_map.enabled_channels()) {
+		size_t frame_first, frame_end;
+		stream.range(ch, &frame_first, &frame_end);
+
+		ssize_t idx_analysis = m_view.time.analysis * stream.sample_rate(ch);
+		ssize_t idx_from = std::max(idx_analysis - m_view.window.size / 2, (ssize_t)frame_first);
+		ssize_t idx_to   = std::min(idx_analysis + m_view.window.size / 2, (ssize_t)frame_end);
+		if(idx_from >= idx_to) continue;
+
+		size_t frames_stride;
+		void *frames_data = stream.read(ch, idx_from, idx_to - idx_from, &frames_stride, m_read_buf);
+		if(frames_data == nullptr) continue;
+
+		sample_dispatch(stream.sample_type(), frames_data, [&](auto *data) {
+			using T = std::remove_cvref_t<decltype(*data)>;
+			constexpr Sample scale = 1.0f / SampleTraits<T>::max;
+			for(ssize_t idx=0; idx<idx_to-idx_from; idx++) {
+				Sample v = data[idx * frames_stride] * scale;
+				m_hists[ch].add(v);
+				vmin = std::min(vmin, v);
+				vmax = std::max(vmax, v);
+			}
+		});
 	}
 
 	m_vmin = m_agc ? vmin : -k_sample_max;
@@ -68,6 +68,10 @@ void WidgetSources::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 		
 			source->draw();
 
+			auto &ingest = source->ingest();
+			ImGui::Text("offset %+.1f ms, drift %+.1f ppm, underruns %zu",
+					ingest.offset * 1000.0, (ingest.ratio - 1.0) * 1e6, ingest.underruns);
+
 			for(size_t i=0; i<source->channel_count(); i++) {
 				ImGui::PushID(ch);
 				char chan_label[32];
@@ -27,6 +27,7 @@ private:
 
 	Fft m_fft{};
 	Fft::Mode m_mode{Fft::Mode::Log};
+	bool m_remove_dc{false};
 
 	std::vector<Sample> m_out_graph;
 };
@@ -51,12 +52,14 @@ void WidgetSpectrum::do_load(ConfigReader::Node *node)
 	int mode;
 	node->read("mode", mode);
 	m_mode = static_cast<Fft::Mode>(mode);
+	node->read("remove_dc", m_remove_dc);
 }
 
 
 void WidgetSpectrum::do_save(ConfigWriter &cw)
 {
 	cw.write("mode", (int)m_mode);
+	cw.write("remove_dc", m_remove_dc);
 }
 
 
@@ -64,6 +67,7 @@ void WidgetSpectrum::do_copy(Widget *w)
 {
 	auto *ws = dynamic_cast<WidgetSpectrum *>(w);
 	m_mode = ws->m_mode;
+	m_remove_dc = ws->m_remove_dc;
 }
 
 
@@ -73,6 +77,8 @@ void WidgetSpectrum::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 	ImGui::SameLine();
 	ImGui::ToggleButton("LOG", &log);
 	m_mode = log ? Fft::Mode::Log : Fft::Mode::Lin;
+	ImGui::SameLine();
+	ImGui::ToggleButton("-DC", &m_remove_dc);
 
 	if(ImGui::IsWindowFocused()) {
 		ImGui::SetCursorPosY(r.h + ImGui::GetTextLineHeightWithSpacing());
@@ -84,26 +90,34 @@ void WidgetSpectrum::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 	double graph_max = (m_mode == Fft::Mode::Log) ? m_view.aperture.to : m_view.amplitude.to;
 
 	m_fft.configure(m_view.window.size, m_view.window.window_type, m_view.window.window_beta, m_mode);
+	m_fft.set_remove_dc(m_remove_dc);
 
 	SDL_SetRenderDrawBlendMode(rend, SDL_BLENDMODE_ADD);
 
 	for(int ch : m_channel_map.enabled_channels()) {
-		size_t stride = 0;
-		size_t avail = 0;
-		Sample *data = stream.peek(&stride, &avail);
-		int idx = ((int)(stream.sample_rate() * m_view.time.analysis - m_view.window.size * 0.5)) * stride + ch;
-
+		ssize_t idx = stream.sample_rate(ch) * m_view.time.analysis - m_view.window.size * 0.5;
 		if(idx < 0) continue;
-		if(idx >= (int)(avail * stride)) continue;
-
-		auto out_graph = m_fft.run(&data[idx], stride);
 
+		size_t stride = 0;
+		bool in_ring = false;
+		void *data = stream.read(ch, idx, m_view.window.size, &stride, m_read_buf, &in_ring);
+		if(data == nullptr) continue;
+
+		m_out_graph.resize(m_fft.out_size());
+		sample_dispatch(stream.sample_type(), data, [&](auto *data) {
+			m_fft.run(data, stride, m_out_graph);
+		});
+		if(in_ring && !stream.read_valid(ch, idx)) continue;
+
+		// the frequency axis is relative to the stream rate, the channel
+		// group may run at a different rate
 		size_t npoints = m_view.window.size / 2 + 1;
+		double fscale = stream.sample_rate() / stream.sample_rate(ch);
 		SDL_SetRenderDrawColor(rend, Style::channel_color(ch));
 		graph(rend, r,
-				out_graph.data(), out_graph.size(), 1,
+				m_out_graph.data(), m_out_graph.size(), 1,
 				1.00,
-				m_view.freq.from * npoints, m_view.freq.to * npoints,
+				m_view.freq.from * npoints * fscale, m_view.freq.to * npoints * fscale,
 				graph_min, graph_max);
 	}
 	
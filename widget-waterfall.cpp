@@ -25,6 +25,8 @@ private:
 		int id;
 		std::thread thread;
 		Fft fft;
+		std::vector<uint8_t> read_buf[Fft::k_batch];
+		std::vector<float> fft_out;
 	};
 
 	enum class JobCmd {
@@ -33,8 +35,8 @@ private:
 
 	struct Job {
 		JobCmd cmd;
-		Sample *data;
-		size_t data_stride;
+		Stream *stream;
+		SampleType data_type;
 		int col_count;
 		Range<int> row;
 		Range<Frequency> f;
@@ -44,6 +46,7 @@ private:
 		Time t_start;
 		Time dt_row;
 		size_t ch;
+		ssize_t frame_min;
 		ssize_t frame_max;
 		ssize_t frames_per_row;
 		Aperture aperture;
@@ -175,7 +178,6 @@ void WidgetWaterfall::allocate_channels(SDL_Renderer *rend, size_t channels, int
 
 	for(auto &w : m_workers) {
 		w->fft.configure(m_view.window.size, m_view.window.window_type, m_view.window.window_beta);
-		w->fft.set_approximate(true);
 	}
 }
 
@@ -187,25 +189,50 @@ void WidgetWaterfall::job_run_gen(Worker &worker, Job &job)
 
 	Time t = job.t_start;
 	uint32_t *p = job.pixels;
-	for(int row=job.row.min; row<job.row.max; row++) {
-		ssize_t frame = (job.srate * t - m_view.window.size / 2);
-		frame = (frame / job.frames_per_row) * job.frames_per_row;
-		if(frame >= 0 && frame < job.frame_max) {
-			auto fft_out = worker.fft.run(&job.data[frame * job.data_stride + job.ch], job.data_stride);
-			for(int col=0; col<job.col_count; col++) {
-				Frequency f = job.f.min + (job.f.max - job.f.min) * col / job.col_count;
-				if(f >= 0 && f <= 1.0) {
-					double db = tabread2(fft_out, f, -127.0f);
-					job.hist.add(db);
-					uint32_t alpha = std::clamp(255 * (db - job.aperture.min) / (job.aperture.max - job.aperture.min), 0.0, 255.0);
-					*p = color | (alpha << 24);
+	worker.fft_out.resize(Fft::k_batch * fft_w);
+
+	// rows are read and transformed in batches
+	for(int row0=job.row.min; row0<job.row.max; row0+=Fft::k_batch) {
+		size_t count = std::min((size_t)(job.row.max - row0), Fft::k_batch);
+		const void *data[Fft::k_batch]{};
+		ssize_t frames[Fft::k_batch];
+		bool in_ring[Fft::k_batch]{};
+		size_t stride = 1;
+
+		for(size_t i=0; i<count; i++) {
+			ssize_t frame = (job.srate * t - m_view.window.size / 2);
+			frame = (frame / job.frames_per_row) * job.frames_per_row;
+			frames[i] = frame;
+			if(frame >= job.frame_min && frame + m_view.window.size <= job.frame_max) {
+				data[i] = job.stream->read(job.ch, frame, m_view.window.size, &stride, worker.read_buf[i], &in_ring[i]);
+			}
+			t += job.dt_row;
+		}
+
+		sample_dispatch(job.data_type, nullptr, [&](auto *type) {
+			using T = std::remove_cvref_t<decltype(*type)>;
+			worker.fft.run_batch((const T *const *)data, count, stride, worker.fft_out);
+		});
+
+		for(size_t i=0; i<count; i++) {
+			// input could have been overwritten by the capture thread
+			bool valid = data[i] && (!in_ring[i] || job.stream->read_valid(job.ch, frames[i]));
+			if(valid) {
+				std::span<const float> fft_out(worker.fft_out.data() + i * fft_w, fft_w);
+				for(int col=0; col<job.col_count; col++) {
+					Frequency f = job.f.min + (job.f.max - job.f.min) * col / job.col_count;
+					if(f >= 0 && f <= 1.0) {
+						double db = tabread2(fft_out, f, -127.0f);
+						job.hist.add(db);
+						uint32_t alpha = std::clamp(255 * (db - job.aperture.min) / (job.aperture.max - job.aperture.min), 0.0, 255.0);
+						*p = color | (alpha << 24);
+					}
+					p ++;
 				}
-				p ++;
+			} else {
+				p += job.col_count;
 			}
-		} else {
-			p += job.col_count;
 		}
-		t += job.dt_row;
 	}
 
 	m_result_queue.push(job);
@@ -267,12 +294,6 @@ void WidgetWaterfall::gen_waterfall(Stream &stream, SDL_Renderer *rend, SDL_Rect
 
 	allocate_channels(rend, stream.channel_count(), r.w, r.h);
 
-	// Get stream data
-
-	size_t stride = 0;
-	size_t frames_avail = 0;
-	Sample *data = stream.peek(&stride, &frames_avail);
-
 	// constriant frame number to always be a muiltiple of indices-per-pixel to
 	// avoid aliasing artifacts when panning
 
@@ -280,6 +301,7 @@ void WidgetWaterfall::gen_waterfall(Stream &stream, SDL_Renderer *rend, SDL_Rect
 	ssize_t frame_to   = m_view.time.to * stream.sample_rate();
 	ssize_t frames_per_row = (frame_to - frame_from) / (m_rotate ? r.w : r.h);
 	if(frames_per_row == 0) frames_per_row = 1;
+	ssize_t frames_avail = stream.duration() * stream.sample_rate();
 
 	// Check if redraw needed
 
@@ -290,7 +312,7 @@ void WidgetWaterfall::gen_waterfall(Stream &stream, SDL_Renderer *rend, SDL_Rect
 	state.window_size = m_view.window.size;
 	state.frame_from = (frame_from / frames_per_row) * frames_per_row;
 	state.frame_to = (frame_to / frames_per_row) * frames_per_row;
-	state.frame_new = std::clamp((ssize_t)frames_avail, state.frame_from, state.frame_to);
+	state.frame_new = std::clamp(frames_avail, state.frame_from, state.frame_to);
 	state.freq_from = m_view.freq.from;
 	state.freq_to = m_view.freq.to;
 	if(state == m_state_prev) return;
@@ -315,27 +337,36 @@ void WidgetWaterfall::gen_waterfall(Stream &stream, SDL_Renderer *rend, SDL_Rect
 
 			Time dt_row = (m_view.time.to - m_view.time.from) / row_count;
 
+			// the channel group may run at a different rate than the
+			// stream, which scales its frame numbers and frequency axis
+			size_t frame_first, frame_end;
+			stream.range(ch, &frame_first, &frame_end);
+			Samplerate srate = stream.sample_rate(ch);
+			double fscale = stream.sample_rate() / srate;
+			ssize_t ch_frames_per_row = std::max((ssize_t)(dt_row * srate), (ssize_t)1);
+
 			for(int row=0; row<row_count; row+=128) {
 
 				Job job;
 				job.cmd = JobCmd::Gen;
-				job.data = data;
-				job.data_stride = stride;
+				job.stream = &stream;
+				job.data_type = stream.sample_type();
 				job.col_count = col_count;
 				job.row.min = row;
 				job.row.max = std::min(row + 128, row_count);
-				job.f.min = m_view.freq.from;
-				job.f.max = m_view.freq.to;
+				job.f.min = m_view.freq.from * fscale;
+				job.f.max = m_view.freq.to * fscale;
 				job.pixels = pixels + job.row.min * (pitch / 4);
-				job.srate = stream.sample_rate();
+				job.srate = srate;
 				job.t_start = m_view.time.from + dt_row * row;
 				job.dt_row = dt_row;
 				job.ch = ch;
-				job.frame_max = frames_avail;
+				job.frame_min = frame_first;
+				job.frame_max = frame_end;
 				job.color = *(uint32_t *)&col & 0x00FFFFFF;
 				job.aperture.min = m_view.aperture.from;
 				job.aperture.max = m_view.aperture.to;
-				job.frames_per_row = frames_per_row;
+				job.frames_per_row = ch_frames_per_row;
 
 				m_job_queue.push(job);
 				m_jobs_in_flight++;
@@ -357,10 +388,6 @@ void WidgetWaterfall::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 	}
 
 
-	size_t stride = 0;
-	size_t frames_avail = 0;
-	Sample *data = stream.peek(&stride, &frames_avail);
-
 	ImGui::SameLine();
 	ImGui::ToggleButton("AGC", &m_agc);
 
@@ -25,8 +25,11 @@ private:
 	void do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r) override;
 	bool do_handle_input(Stream &stream, SDL_Rect &r) override;
 
+	void draw_discontinuities(Stream &stream, SDL_Renderer *rend, SDL_Rect &r, size_t ch, double idx_from, double idx_to);
+
 	bool m_agc{true};
 	double m_peak{};
+	std::vector<Discontinuities::Entry> m_discontinuities;
 
 	std::vector<double> m_channel_offset;
 	int m_handle_dragging{-1};
@@ -101,14 +104,6 @@ void WidgetWaveform::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 	ImGui::SameLine();
 	ImGui::ToggleButton("AGC", &m_agc);
 	
-	size_t frames_avail;
-	size_t data_stride;
-	Sample *data = stream.peek(&data_stride, &frames_avail);
-
-	size_t wframes_avail;
-	size_t wdata_stride;
-	Wavecache::Range *wdata = stream.peek_wavecache(&wdata_stride, &wframes_avail);
-
 	if(ImGui::IsWindowFocused()) {
 		ImGui::SetCursorPosY(r.h + ImGui::GetTextLineHeightWithSpacing());
 		ImGui::Text("t=%.4gs", m_view.time.cursor);
@@ -121,18 +116,20 @@ void WidgetWaveform::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 	}
 	m_peak *= 0.9f;
 
-	double idx_from = m_view.time.from * stream.sample_rate();
-	double idx_to   = m_view.time.to   * stream.sample_rate();
-	double step = (idx_to - idx_from) / r.w;
-
 	SDL_SetRenderDrawBlendMode(rend, SDL_BLENDMODE_ADD);
 
 	SDL_Rect rwave = r;
 	rwave.x += 16;
 	rwave.w -= 16;
 
+	std::vector<Stream::Group *> groups_marked;
+
 	for(auto ch : m_channel_map.enabled_channels()) {
 
+		double idx_from = m_view.time.from * stream.sample_rate(ch);
+		double idx_to   = m_view.time.to   * stream.sample_rate(ch);
+		double step = (idx_to - idx_from) / r.w;
+
 		Style::Color col = Style::channel_color(ch);
 
 		int y = m_view.from_amplitude(m_view_config, r, m_channel_offset[ch]);
@@ -143,24 +140,65 @@ void WidgetWaveform::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 
 		double offset = m_channel_offset[ch];
 
-		if(step < 256) {
-			peak = graph(rend, rwave,
-					data + ch, frames_avail, data_stride,
-					1.0 / k_sample_max,
-					idx_from, idx_to,
-					m_view.amplitude.from - offset,
-					m_view.amplitude.to - offset);
+		Wavecache &wavecache = stream.group_of(ch).wavecache;
+
+		if(step < wavecache.step(0)) {
+			// read the visible frames, from disk if they left the ring
+			// buffer. The start is aligned to keep the graph steady when
+			// panning.
+			size_t frame_first, frame_end;
+			stream.range(ch, &frame_first, &frame_end);
+			size_t frame_from = std::max((size_t)std::max(idx_from, 0.0) & ~(size_t)4095, frame_first);
+			size_t frame_to = std::min((size_t)std::max(idx_to + 1, 0.0), frame_end);
+			size_t data_stride;
+			void *data = nullptr;
+			if(frame_from < frame_to) {
+				data = stream.read(ch, frame_from, frame_to - frame_from, &data_stride, m_read_buf);
+			}
+			peak = 0.0;
+			if(data) {
+				peak = sample_dispatch(stream.sample_type(), data, [&](auto *data) {
+					using T = std::remove_cvref_t<decltype(*data)>;
+					return graph(rend, rwave,
+							data, frame_to - frame_from, data_stride,
+							1.0 / SampleTraits<T>::max,
+							idx_from - frame_from, idx_to - frame_from,
+							m_view.amplitude.from - offset,
+							m_view.amplitude.to - offset);
+				});
+			}
 		} else {
+			// draw from the wavecache level giving about one range per
+			// pixel. The first level only covers the ring buffer, older
+			// history is drawn from the first coarser level reaching back
+			// far enough.
+			size_t level = wavecache.level_for(step);
+			size_t wframes_avail;
+			size_t wdata_stride;
+			size_t wseq;
+			Wavecache::Range *wdata = stream.peek_wavecache(ch, level, &wdata_stride, &wframes_avail, &wseq);
+			while(level + 1 < Wavecache::k_level_count && std::max(idx_from, 0.0) < wseq * wavecache.step(level)) {
+				level ++;
+				wdata = stream.peek_wavecache(ch, level, &wdata_stride, &wframes_avail, &wseq);
+			}
+			double wstep = wavecache.step(level);
 			peak = graph(rend, rwave,
-					&wdata[ch].min, &wdata[ch].max, 
-					frames_avail / 256, wdata_stride * 2,
+					&wdata[0].min, &wdata[0].max, 
+					wframes_avail, wdata_stride * (sizeof(Wavecache::Range) / sizeof(Sample)),
 					1.0 / k_sample_max,
-					idx_from / 256, idx_to / 256,
+					idx_from / wstep - wseq, idx_to / wstep - wseq,
 					m_view.amplitude.from - offset,
 					m_view.amplitude.to - offset);
 		}
 
 		m_peak = std::max(m_peak, peak);
+
+		// discontinuities are marked once for each group
+		Stream::Group *group = &stream.group_of(ch);
+		if(std::find(groups_marked.begin(), groups_marked.end(), group) == groups_marked.end()) {
+			draw_discontinuities(stream, rend, rwave, ch, idx_from, idx_to);
+			groups_marked.push_back(group);
+		}
 	}
 	
 	// selection
@@ -184,6 +222,36 @@ void WidgetWaveform::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 }
 
 
+// Mark the spans of the group holding channel ch that do not hold captured
+// data
+
+void WidgetWaveform::draw_discontinuities(Stream &stream, SDL_Renderer *rend, SDL_Rect &r, size_t ch, double idx_from, double idx_to)
+{
+	size_t frame_from = std::max(idx_from, 0.0);
+	size_t frame_to = std::max(idx_to, 0.0);
+	stream.discontinuities(ch).query(frame_from, frame_to, m_discontinuities);
+	if(m_discontinuities.empty()) return;
+
+	double px = r.w / (idx_to - idx_from);
+	auto pos = ImGui::GetIO().MousePos;
+
+	SDL_SetRenderDrawBlendMode(rend, SDL_BLENDMODE_BLEND);
+	SDL_SetRenderDrawColor(rend, Style::color(Style::ColorId::Discontinuity));
+
+	for(auto &e : m_discontinuities) {
+		float x = r.x + ((double)e.frame - idx_from) * px;
+		float w = std::max(e.frame_count * px, 1.0);
+		SDL_FRect rect = { x, (float)r.y, w, (float)r.h };
+		SDL_RenderFillRect(rend, &rect);
+
+		if(pos.x >= x - 2 && pos.x <= x + w + 2 && pos.y >= r.y && pos.y < r.y + r.h) {
+			ImGui::SetTooltip("%s: %zu frames, source %d", 
+					Discontinuities::cause_str(e.cause), e.frame_count, e.source);
+		}
+	}
+}
+
+
 bool WidgetWaveform::do_handle_input(Stream &stream, SDL_Rect &r)
 {
     auto pos = ImGui::GetIO().MousePos;
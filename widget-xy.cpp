@@ -28,6 +28,7 @@ private:
 	double m_peak{1.0};
 	float m_decay{0.2};
 	bool m_agc{true};
+	std::vector<uint8_t> m_read_buf_y{};
 };
 
 
@@ -87,15 +88,29 @@ void WidgetXY::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 		if(ch_x == -1) ch_x = ch; else if(ch_y == -1) ch_y = ch;
 	if(ch_x == -1 || ch_y == -1) return;
 	
-	size_t frames_stride;
-	size_t frames_avail;
-	Sample *frames_data = stream.peek(&frames_stride, &frames_avail);
-
-	int idx_from = m_view.time.analysis * stream.sample_rate();
-	int idx_to   = idx_from + m_view.window.size;
-
-	if(idx_to < 0) return;
-	if(idx_from > (int)frames_avail) return;
+	// x and y may be in groups of different rates, y is sampled at the
+	// time of each x sample
+	double y_ratio = stream.sample_rate(ch_y) / stream.sample_rate(ch_x);
+	size_t x_first, x_end;
+	size_t y_first, y_end;
+	stream.range(ch_x, &x_first, &x_end);
+	stream.range(ch_y, &y_first, &y_end);
+	if(y_end == 0) return;
+	x_first = std::max(x_first, (size_t)ceil(y_first / y_ratio));
+	x_end = std::min(x_end, (size_t)((y_end - 1) / y_ratio));
+
+	ssize_t idx_from = m_view.time.analysis * stream.sample_rate(ch_x);
+	ssize_t idx_to   = idx_from + m_view.window.size;
+	idx_from = std::max(idx_from, (ssize_t)x_first);
+	idx_to = std::min(idx_to, (ssize_t)x_end);
+	if(idx_from >= idx_to) return;
+
+	size_t y_from = idx_from * y_ratio;
+	size_t y_count = (size_t)((idx_to - 1) * y_ratio) - y_from + 1;
+	size_t x_stride, y_stride;
+	void *x_data = stream.read(ch_x, idx_from, idx_to - idx_from, &x_stride, m_read_buf);
+	void *y_data = stream.read(ch_y, y_from, y_count, &y_stride, m_read_buf_y);
+	if(x_data == nullptr || y_data == nullptr) return;
 
 	std::vector<SDL_FPoint> point(idx_to - idx_from);
 	size_t npoints = 0;
@@ -108,16 +123,21 @@ void WidgetXY::do_draw(Stream &stream, SDL_Renderer *rend, SDL_Rect &r)
 	double sy = (double)(r.h / 2) / m_peak;
 	m_peak *= 0.95;
 		
-	for(int idx=idx_from; idx<idx_to; idx++) {
-		if(idx < 0 || idx >= (int)frames_avail) continue;
-		Sample vx = frames_data[idx * frames_stride + ch_x];
-		Sample vy = frames_data[idx * frames_stride + ch_y];
-		m_peak = std::max(m_peak, (double)fabs(vx));
-		m_peak = std::max(m_peak, (double)fabs(vy));
-		point[npoints].x = cx + vx * sx;
-		point[npoints].y = cy - vy * sy;
-		npoints++;
-	}
+	sample_dispatch(stream.sample_type(), x_data, [&](auto *data) {
+		using T = std::remove_cvref_t<decltype(*data)>;
+		constexpr Sample scale = 1.0f / SampleTraits<T>::max;
+		auto *data_y = (decltype(data))y_data;
+		for(ssize_t idx=idx_from; idx<idx_to; idx++) {
+			size_t idx_y = std::min((size_t)(idx * y_ratio) - y_from, y_count - 1);
+			Sample vx = data[(idx - idx_from) * x_stride] * scale;
+			Sample vy = data_y[idx_y * y_stride] * scale;
+			m_peak = std::max(m_peak, (double)fabs(vx));
+			m_peak = std::max(m_peak, (double)fabs(vy));
+			point[npoints].x = cx + vx * sx;
+			point[npoints].y = cy - vy * sy;
+			npoints++;
+		}
+	});
 
 	static bool n = false;
 	n = 1-n;
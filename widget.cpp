@@ -185,11 +185,8 @@ void Widget::handle_input(Stream &stream, SDL_Rect &r)
 	// key 'A': reset view
 	if(ImGui::IsKeyPressed(ImGuiKey_A)) {
 		if(m_view_config.x == View::Axis::Time || m_view_config.y == View::Axis::Time) {
-			size_t stride = 0;
-			size_t frames_avail = 0;
-			Sample *data = stream.peek(&stride, &frames_avail);
 			m_view.time.from = 0.0;
-			m_view.time.to   = frames_avail / stream.sample_rate();
+			m_view.time.to   = stream.duration();
 		}
 		if(m_view_config.x == View::Axis::Amplitude || m_view_config.y == View::Axis::Amplitude) {
 			m_view.amplitude.from = -1.0;
@@ -242,23 +239,26 @@ void Widget::handle_input(Stream &stream, SDL_Rect &r)
 }
 
 
-template double Widget::graph<Sample>(SDL_Renderer*, SDL_Rect&, Sample[],           size_t, size_t, double, double, double, double, double);
-template double Widget::graph<Sample>(SDL_Renderer*, SDL_Rect&, Sample[], Sample[], size_t, size_t, double, double, double, double, double);
+template double Widget::graph<int16_t >(SDL_Renderer*, SDL_Rect&, const int16_t[],                   size_t, size_t, double, double, double, double, double);
+template double Widget::graph<int16_t >(SDL_Renderer*, SDL_Rect&, const int16_t[], const int16_t[],  size_t, size_t, double, double, double, double, double);
 
-template double Widget::graph<int8_t>(SDL_Renderer*, SDL_Rect&, int8_t[],           size_t, size_t, double, double, double, double, double);
-template double Widget::graph<int8_t>(SDL_Renderer*, SDL_Rect&, int8_t[], int8_t[], size_t, size_t, double, double, double, double, double);
+template double Widget::graph<_Float16>(SDL_Renderer*, SDL_Rect&, const _Float16[],                  size_t, size_t, double, double, double, double, double);
+template double Widget::graph<_Float16>(SDL_Renderer*, SDL_Rect&, const _Float16[], const _Float16[], size_t, size_t, double, double, double, double, double);
 
-template double Widget::graph<size_t>(SDL_Renderer*, SDL_Rect&, size_t[],           size_t, size_t, double, double, double, double, double);
-template double Widget::graph<size_t>(SDL_Renderer*, SDL_Rect&, size_t[], size_t[], size_t, size_t, double, double, double, double, double);
+template double Widget::graph<int8_t  >(SDL_Renderer*, SDL_Rect&, const int8_t[],                    size_t, size_t, double, double, double, double, double);
+template double Widget::graph<int8_t  >(SDL_Renderer*, SDL_Rect&, const int8_t[], const int8_t[],    size_t, size_t, double, double, double, double, double);
 
-template double Widget::graph<float >(SDL_Renderer*, SDL_Rect&, float [],           size_t, size_t, double, double, double, double, double);
-template double Widget::graph<float >(SDL_Renderer*, SDL_Rect&, float [], float [], size_t, size_t, double, double, double, double, double);
+template double Widget::graph<size_t  >(SDL_Renderer*, SDL_Rect&, const size_t[],                    size_t, size_t, double, double, double, double, double);
+template double Widget::graph<size_t  >(SDL_Renderer*, SDL_Rect&, const size_t[], const size_t[],    size_t, size_t, double, double, double, double, double);
+
+template double Widget::graph<float   >(SDL_Renderer*, SDL_Rect&, const float[],                     size_t, size_t, double, double, double, double, double);
+template double Widget::graph<float   >(SDL_Renderer*, SDL_Rect&, const float[], const float[],      size_t, size_t, double, double, double, double, double);
 
 
 
 template<typename T>
 double Widget::graph(SDL_Renderer *rend, SDL_Rect &r,
-					 T data[], size_t data_count, size_t stride,
+					 const T data[], size_t data_count, size_t stride,
 					 double scale,
 					 double idx_from, double idx_to,
 					 double y_min, double y_max)
@@ -269,7 +269,7 @@ double Widget::graph(SDL_Renderer *rend, SDL_Rect &r,
 
 template<typename T>
 double Widget::graph(SDL_Renderer *rend, SDL_Rect &r,
-					 T data_min[], T data_max[], size_t data_count, size_t stride,
+					 const T data_min[], const T data_max[], size_t data_count, size_t stride,
 					 double scale,
 					 double idx_from, double idx_to,
 					 double y_min, double y_max)
@@ -56,14 +56,14 @@ protected:
 
 	template<typename T>
 	double graph(SDL_Renderer *rend, SDL_Rect &r,
-						 T data[], size_t data_count, size_t stride,
+						 const T data[], size_t data_count, size_t stride,
 						 double scale,
 						 double idx_from, double idx_to,
 						 double y_min, double y_max);
 	
 	template<typename T>
 	double graph(SDL_Renderer *rend, SDL_Rect &r,
-						 T data_min[], T data_max[], size_t data_count, size_t stride,
+						 const T data_min[], const T data_max[], size_t data_count, size_t stride,
 						 double scale,
 						 double idx_from, double idx_to,
 						 double y_min, double y_max);
@@ -90,6 +90,7 @@ protected:
 	Info &m_info;
 	View m_view{};
 	ChannelMap m_channel_map{};
+	std::vector<uint8_t> m_read_buf{};
 	double m_pan_speed{};
 	View::Config m_view_config{};
 };